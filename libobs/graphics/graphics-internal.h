@@ -241,12 +241,23 @@ struct gs_exports {
 	gs_texture_t *(*device_texture_open_shared)(gs_device_t *device,
 				uint32_t handle);
 #endif
+
+	/* optional, falls back to device_blend_function with the color
+	 * factors if the module doesn't export it */
+	void (*device_blend_function_separate)(gs_device_t *device,
+			enum gs_blend_type src_c, enum gs_blend_type dest_c,
+			enum gs_blend_type src_a, enum gs_blend_type dest_a);
 };
 
 struct blend_state {
 	bool               enabled;
-	enum gs_blend_type src;
-	enum gs_blend_type dest;
+	enum gs_blend_type src_c;
+	enum gs_blend_type dest_c;
+	enum gs_blend_type src_a;
+	enum gs_blend_type dest_a;
+
+	/* gs_reset_blend_state uses ONE/INVSRCALPHA for alpha */
+	bool               accumulate_alpha;
 };
 
 struct graphics_subsystem {
@@ -276,4 +287,5 @@ struct graphics_subsystem {
 	volatile long          ref;
 
 	struct blend_state     cur_blend_state;
+	DARRAY(struct blend_state) blend_state_stack;
 };
@@ -107,8 +107,10 @@ static bool graphics_init(struct graphics_subsystem *graphics)
 	graphics->exports.device_blend_function(graphics->device,
 			GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA);
 	graphics->cur_blend_state.enabled = true;
-	graphics->cur_blend_state.src     = GS_BLEND_SRCALPHA;
-	graphics->cur_blend_state.dest    = GS_BLEND_INVSRCALPHA;
+	graphics->cur_blend_state.src_c   = GS_BLEND_SRCALPHA;
+	graphics->cur_blend_state.dest_c  = GS_BLEND_INVSRCALPHA;
+	graphics->cur_blend_state.src_a   = GS_BLEND_SRCALPHA;
+	graphics->cur_blend_state.dest_a  = GS_BLEND_INVSRCALPHA;
 
 	graphics->exports.device_leave_context(graphics->device);
 
@@ -175,6 +177,7 @@ void gs_destroy(graphics_t *graphics)
 	pthread_mutex_destroy(&graphics->mutex);
 	da_free(graphics->matrix_stack);
 	da_free(graphics->viewport_stack);
+	da_free(graphics->blend_state_stack);
 	if (graphics->module)
 		os_dlclose(graphics->module);
 	bfree(graphics);
@@ -938,14 +941,61 @@ void gs_perspective(float angle, float aspect, float near, float far)
 void gs_reset_blend_state(void)
 {
 	graphics_t *graphics = thread_graphics;
+	enum gs_blend_type src_a;
 	if (!graphics) return;
 
+	src_a = graphics->cur_blend_state.accumulate_alpha ?
+		GS_BLEND_ONE : GS_BLEND_SRCALPHA;
+
 	if (!graphics->cur_blend_state.enabled)
 		gs_enable_blending(true);
 
-	if (graphics->cur_blend_state.src  != GS_BLEND_SRCALPHA ||
-	    graphics->cur_blend_state.dest != GS_BLEND_INVSRCALPHA)
-		gs_blend_function(GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA);
+	if (graphics->cur_blend_state.src_c  != GS_BLEND_SRCALPHA    ||
+	    graphics->cur_blend_state.dest_c != GS_BLEND_INVSRCALPHA ||
+	    graphics->cur_blend_state.src_a  != src_a                ||
+	    graphics->cur_blend_state.dest_a != GS_BLEND_INVSRCALPHA)
+		gs_blend_function_separate(
+				GS_BLEND_SRCALPHA, GS_BLEND_INVSRCALPHA,
+				src_a, GS_BLEND_INVSRCALPHA);
+}
+
+void gs_enable_alpha_accumulation(bool enable)
+{
+	graphics_t *graphics = thread_graphics;
+	if (!graphics) return;
+
+	graphics->cur_blend_state.accumulate_alpha = enable;
+}
+
+void gs_blend_state_push(void)
+{
+	graphics_t *graphics = thread_graphics;
+	if (!graphics) return;
+
+	da_push_back(graphics->blend_state_stack, &graphics->cur_blend_state);
+}
+
+void gs_blend_state_pop(void)
+{
+	graphics_t *graphics = thread_graphics;
+	struct blend_state *state;
+	if (!graphics || !graphics->blend_state_stack.num)
+		return;
+
+	state = da_end(graphics->blend_state_stack);
+
+	if (state->enabled != graphics->cur_blend_state.enabled)
+		gs_enable_blending(state->enabled);
+
+	if (state->src_c  != graphics->cur_blend_state.src_c  ||
+	    state->dest_c != graphics->cur_blend_state.dest_c ||
+	    state->src_a  != graphics->cur_blend_state.src_a  ||
+	    state->dest_a != graphics->cur_blend_state.dest_a)
+		gs_blend_function_separate(state->src_c, state->dest_c,
+				state->src_a, state->dest_a);
+
+	graphics->cur_blend_state.accumulate_alpha = state->accumulate_alpha;
+	da_pop_back(graphics->blend_state_stack);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1425,11 +1475,34 @@ void gs_blend_function(enum gs_blend_type src, enum gs_blend_type dest)
 	graphics_t *graphics = thread_graphics;
 	if (!graphics) return;
 
-	graphics->cur_blend_state.src  = src;
-	graphics->cur_blend_state.dest = dest;
+	graphics->cur_blend_state.src_c  = src;
+	graphics->cur_blend_state.dest_c = dest;
+	graphics->cur_blend_state.src_a  = src;
+	graphics->cur_blend_state.dest_a = dest;
 	graphics->exports.device_blend_function(graphics->device, src, dest);
 }
 
+void gs_blend_function_separate(
+		enum gs_blend_type src_c, enum gs_blend_type dest_c,
+		enum gs_blend_type src_a, enum gs_blend_type dest_a)
+{
+	graphics_t *graphics = thread_graphics;
+	if (!graphics) return;
+
+	if (!graphics->exports.device_blend_function_separate ||
+	    (src_c == src_a && dest_c == dest_a)) {
+		gs_blend_function(src_c, dest_c);
+		return;
+	}
+
+	graphics->cur_blend_state.src_c  = src_c;
+	graphics->cur_blend_state.dest_c = dest_c;
+	graphics->cur_blend_state.src_a  = src_a;
+	graphics->cur_blend_state.dest_a = dest_a;
+	graphics->exports.device_blend_function_separate(graphics->device,
+			src_c, dest_c, src_a, dest_a);
+}
+
 void gs_depth_function(enum gs_depth_test test)
 {
 	graphics_t *graphics = thread_graphics;
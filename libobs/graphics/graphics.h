@@ -520,6 +520,18 @@ EXPORT void gs_perspective(float fovy, float aspect, float znear, float zfar);
 
 EXPORT void gs_reset_blend_state(void);
 
+/**
+ * While enabled, gs_reset_blend_state adds alpha on top of the destination
+ * alpha (ONE/INVSRCALPHA) instead of multiplying it by the source alpha
+ * again.  For rendering in to a texture that is drawn with premultiplied
+ * alpha afterwards.  Saved and restored with the blend state.
+ */
+EXPORT void gs_enable_alpha_accumulation(bool enable);
+
+/** Saves and restores blending, the blend factors and alpha accumulation */
+EXPORT void gs_blend_state_push(void);
+EXPORT void gs_blend_state_pop(void);
+
 /* -------------------------- */
 /* library-specific functions */
 
@@ -612,6 +624,9 @@ EXPORT void gs_enable_stencil_write(bool enable);
 EXPORT void gs_enable_color(bool red, bool green, bool blue, bool alpha);
 
 EXPORT void gs_blend_function(enum gs_blend_type src, enum gs_blend_type dest);
+EXPORT void gs_blend_function_separate(
+		enum gs_blend_type src_c, enum gs_blend_type dest_c,
+		enum gs_blend_type src_a, enum gs_blend_type dest_a);
 EXPORT void gs_depth_function(enum gs_depth_test test);
 
 EXPORT void gs_stencil_function(enum gs_stencil_side side,
@@ -0,0 +1,167 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/c99defs.h"
+#include "../util/circlebuf.h"
+#include "media-io-defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Audio framer
+ *
+ *   Cuts audio that comes in at any size in to frames of a fixed size (for
+ * example the frame size of an audio encoder).  Frames are handed out as
+ * pointers in to the buffered data instead of being copied out, data is only
+ * copied when a frame happens to wrap around the end of the buffer.
+ *
+ *   A frame stays valid until audio_framer_pop, even if more data is pushed
+ * in the meantime, so a producer and consumer on different threads only need
+ * to lock around the calls themselves, not around the use of the frame.
+ */
+
+/* the buffers start out with room for this many frames, which keeps wraps
+ * rare when data comes in at multiples of the frame size */
+#define AUDIO_FRAMER_RESERVE_FRAMES 8
+
+struct audio_framer {
+	struct circlebuf buffers[MAX_AV_PLANES];
+	uint8_t          *wrapped[MAX_AV_PLANES];
+	uint8_t          *retired[MAX_AV_PLANES];
+	size_t           planes;
+	size_t           frame_size;
+	bool             viewing;
+};
+
+static inline void audio_framer_init(struct audio_framer *af, size_t planes,
+		size_t frame_size)
+{
+	memset(af, 0, sizeof(struct audio_framer));
+	af->planes     = planes;
+	af->frame_size = frame_size;
+
+	for (size_t i = 0; i < planes; i++)
+		circlebuf_reserve(&af->buffers[i],
+				frame_size * AUDIO_FRAMER_RESERVE_FRAMES);
+}
+
+static inline void audio_framer_free(struct audio_framer *af)
+{
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		circlebuf_free(&af->buffers[i]);
+		bfree(af->wrapped[i]);
+		bfree(af->retired[i]);
+	}
+
+	memset(af, 0, sizeof(struct audio_framer));
+}
+
+/** Returns the number of bytes buffered in each plane */
+static inline size_t audio_framer_size(const struct audio_framer *af)
+{
+	return af->buffers[0].size;
+}
+
+/* moves a plane to a new allocation instead of reallocating it in place,
+ * the old one is freed once the frame being viewed has been popped */
+static inline void audio_framer_move_plane(struct audio_framer *af,
+		size_t plane, size_t min_capacity)
+{
+	struct circlebuf *cb = &af->buffers[plane];
+	size_t capacity = cb->capacity * 2;
+	uint8_t *data;
+
+	if (capacity < min_capacity)
+		capacity = min_capacity;
+
+	data = (uint8_t*)bmalloc(capacity);
+	circlebuf_peek_front(cb, data, cb->size);
+
+	af->retired[plane] = (uint8_t*)cb->data;
+	cb->data      = data;
+	cb->start_pos = 0;
+	cb->end_pos   = cb->size;
+	cb->capacity  = capacity;
+}
+
+/** Appends 'size' bytes to each plane */
+static inline void audio_framer_push(struct audio_framer *af,
+		uint8_t *const *data, size_t size)
+{
+	for (size_t i = 0; i < af->planes; i++) {
+		struct circlebuf *cb = &af->buffers[i];
+
+		if (af->viewing && !af->retired[i] &&
+		    cb->size + size > cb->capacity)
+			audio_framer_move_plane(af, i, cb->size + size);
+
+		circlebuf_push_back(cb, data[i], size);
+	}
+}
+
+/**
+ * Gets the next frame without removing it.  Each plane points either in to
+ * the buffered data or, if it wraps, to a copy of it.
+ *
+ * @return  false if there isn't a full frame buffered yet
+ */
+static inline bool audio_framer_peek(struct audio_framer *af,
+		uint8_t *frame[MAX_AV_PLANES])
+{
+	if (!af->frame_size || af->buffers[0].size < af->frame_size)
+		return false;
+
+	for (size_t i = 0; i < af->planes; i++) {
+		struct circlebuf *cb = &af->buffers[i];
+
+		if (cb->capacity - cb->start_pos >= af->frame_size) {
+			frame[i] = (uint8_t*)cb->data + cb->start_pos;
+		} else {
+			if (!af->wrapped[i])
+				af->wrapped[i] = (uint8_t*)bmalloc(
+						af->frame_size);
+
+			circlebuf_peek_front(cb, af->wrapped[i],
+					af->frame_size);
+			frame[i] = af->wrapped[i];
+		}
+	}
+
+	af->viewing = true;
+	return true;
+}
+
+/** Removes the frame returned by audio_framer_peek */
+static inline void audio_framer_pop(struct audio_framer *af)
+{
+	for (size_t i = 0; i < af->planes; i++) {
+		circlebuf_pop_front(&af->buffers[i], NULL, af->frame_size);
+
+		bfree(af->retired[i]);
+		af->retired[i] = NULL;
+	}
+
+	af->viewing = false;
+}
+
+#ifdef __cplusplus
+}
+#endif
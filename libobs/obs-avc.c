@@ -33,13 +33,6 @@ enum {
 	NAL_FILLER    = 12,
 };
 
-enum {
-	NAL_PRIORITY_DISPOSABLE = 0,
-	NAL_PRIORITY_LOW        = 1,
-	NAL_PRIORITY_HIGH       = 2,
-	NAL_PRIORITY_HIGHEST    = 3,
-};
-
 /* NOTE: I noticed that FFmpeg does some unusual special handling of certain
  * scenarios that I was unaware of, so instead of just searching for {0, 0, 1}
  * we'll just use the code from FFmpeg - http://www.ffmpeg.org/ */
@@ -88,14 +81,31 @@ const uint8_t *obs_avc_find_startcode(const uint8_t *p, const uint8_t *end)
 	return out;
 }
 
-static inline int get_drop_priority(int priority)
+/* walks the 4 byte length prefixes of an AVCC packet to find the first
+ * slice, no start code scan is needed */
+static void parse_avcc_priority(const uint8_t *data, size_t size,
+		bool *is_keyframe, int *priority)
 {
-	switch (priority) {
-	case NAL_PRIORITY_DISPOSABLE: return NAL_PRIORITY_DISPOSABLE;
-	case NAL_PRIORITY_LOW:        return NAL_PRIORITY_LOW;
-	}
+	const uint8_t *end = data + size;
+
+	while (end - data > 4) {
+		size_t nal_size = ((size_t)data[0] << 24) | (data[1] << 16) |
+			(data[2] << 8) | data[3];
+		int type;
+
+		data += 4;
+		if (!nal_size || nal_size > (size_t)(end - data))
+			break;
+
+		type = data[0] & 0x1F;
+		if (type == NAL_SLICE_IDR || type == NAL_SLICE) {
+			*is_keyframe = (type == NAL_SLICE_IDR);
+			*priority    = data[0] >> 5;
+			break;
+		}
 
-	return NAL_PRIORITY_HIGHEST;
+		data += nal_size;
+	}
 }
 
 static void serialize_avc_data(struct serializer *s, const uint8_t *data,
@@ -137,12 +147,74 @@ void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 	array_output_serializer_init(&s, &output);
 	*avc_packet = *src;
 
-	serialize_avc_data(&s, src->data, src->size, &avc_packet->keyframe,
-			&avc_packet->priority);
+	if (src->avcc) {
+		s_write(&s, src->data, src->size);
+		parse_avcc_priority(src->data, src->size,
+				&avc_packet->keyframe, &avc_packet->priority);
+	} else {
+		serialize_avc_data(&s, src->data, src->size,
+				&avc_packet->keyframe, &avc_packet->priority);
+	}
 
 	avc_packet->data          = output.bytes.array;
 	avc_packet->size          = output.bytes.num;
-	avc_packet->drop_priority = get_drop_priority(avc_packet->priority);
+	avc_packet->refs          = NULL;
+	avc_packet->drop_priority =
+		obs_avc_get_drop_priority(avc_packet->priority);
+}
+
+void obs_parse_avc_packet_priority(struct encoder_packet *packet)
+{
+	const uint8_t *nal_start;
+	const uint8_t *end = packet->data + packet->size;
+	int type;
+
+	if (packet->avcc) {
+		parse_avcc_priority(packet->data, packet->size,
+				&packet->keyframe, &packet->priority);
+		packet->drop_priority =
+			obs_avc_get_drop_priority(packet->priority);
+		return;
+	}
+
+	nal_start = obs_avc_find_startcode(packet->data, end);
+	while (true) {
+		while (nal_start < end && !*(nal_start++));
+
+		if (nal_start == end)
+			break;
+
+		/* all slices of a frame share the same type and priority, so
+		 * there's no need to look past the first one */
+		type = nal_start[0] & 0x1F;
+		if (type == NAL_SLICE_IDR || type == NAL_SLICE) {
+			packet->keyframe = (type == NAL_SLICE_IDR);
+			packet->priority = nal_start[0] >> 5;
+			break;
+		}
+
+		nal_start = obs_avc_find_startcode(nal_start, end);
+	}
+
+	packet->drop_priority = obs_avc_get_drop_priority(packet->priority);
+}
+
+void obs_avcc_to_annexb(uint8_t *data, size_t size)
+{
+	static const uint8_t start_code[4] = {0, 0, 0, 1};
+	uint8_t *end = data + size;
+
+	while (end - data > 4) {
+		size_t nal_size = ((size_t)data[0] << 24) | (data[1] << 16) |
+			(data[2] << 8) | data[3];
+
+		memcpy(data, start_code, sizeof(start_code));
+		data += 4;
+
+		if (nal_size > (size_t)(end - data))
+			break;
+		data += nal_size;
+	}
 }
 
 static inline bool has_start_code(const uint8_t *data)
@@ -25,12 +25,46 @@ extern "C" {
 
 struct encoder_packet;
 
+/* packet priority values, taken from nal_ref_idc of the frame's slices */
+enum {
+	OBS_NAL_PRIORITY_DISPOSABLE = 0,
+	OBS_NAL_PRIORITY_LOW        = 1,
+	OBS_NAL_PRIORITY_HIGH       = 2,
+	OBS_NAL_PRIORITY_HIGHEST    = 3,
+};
+
+/**
+ * Returns the priority a stream has to wait for before it can continue after
+ * dropping a packet of the given priority
+ */
+static inline int obs_avc_get_drop_priority(int priority)
+{
+	switch (priority) {
+	case OBS_NAL_PRIORITY_DISPOSABLE: return OBS_NAL_PRIORITY_DISPOSABLE;
+	case OBS_NAL_PRIORITY_LOW:        return OBS_NAL_PRIORITY_LOW;
+	}
+
+	return OBS_NAL_PRIORITY_HIGHEST;
+}
+
 /* Helpers for parsing AVC NAL units.  */
 
 EXPORT const uint8_t *obs_avc_find_startcode(const uint8_t *p,
 		const uint8_t *end);
 EXPORT void obs_parse_avc_packet(struct encoder_packet *avc_packet,
 		const struct encoder_packet *src);
+
+/**
+ * Sets the keyframe and priority values of a packet in place, without
+ * converting the packet data.  Handles both annex-b and AVCC packets.
+ */
+EXPORT void obs_parse_avc_packet_priority(struct encoder_packet *packet);
+
+/**
+ * Converts AVCC framed data to annex-b in place by replacing each 4 byte size
+ * prefix with a 4 byte start code.
+ */
+EXPORT void obs_avcc_to_annexb(uint8_t *data, size_t size);
 EXPORT size_t obs_parse_avc_header(uint8_t **header, const uint8_t *data,
 		size_t size);
 
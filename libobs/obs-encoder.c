@@ -41,6 +41,8 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 {
 	pthread_mutex_init_value(&encoder->callbacks_mutex);
 	pthread_mutex_init_value(&encoder->outputs_mutex);
+	pthread_mutex_init_value(&encoder->update_mutex);
+	pthread_mutex_init_value(&encoder->audio_mutex);
 
 	if (!obs_context_data_init(&encoder->context, settings, name))
 		return false;
@@ -48,6 +50,10 @@ static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		return false;
 	if (pthread_mutex_init(&encoder->outputs_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&encoder->update_mutex, NULL) != 0)
+		return false;
+	if (pthread_mutex_init(&encoder->audio_mutex, NULL) != 0)
+		return false;
 
 	if (encoder->info.get_defaults)
 		encoder->info.get_defaults(encoder->context.settings);
@@ -142,12 +148,56 @@ static inline bool has_scaling(const struct obs_encoder *encoder)
 		 video_height != encoder->scaled_height);
 }
 
+static void *audio_encode_thread(void *data);
+
+static bool start_audio_thread(struct obs_encoder *encoder)
+{
+	encoder->audio_thread_exit = false;
+
+	if (os_sem_init(&encoder->audio_sem, 0) != 0)
+		return false;
+
+	if (pthread_create(&encoder->audio_thread, NULL, audio_encode_thread,
+				encoder) != 0) {
+		os_sem_destroy(encoder->audio_sem);
+		encoder->audio_sem = NULL;
+		return false;
+	}
+
+	encoder->audio_thread_active = true;
+	return true;
+}
+
+static void stop_audio_thread(struct obs_encoder *encoder)
+{
+	if (!encoder->audio_thread_active)
+		return;
+
+	encoder->audio_thread_exit = true;
+	os_sem_post(encoder->audio_sem);
+	pthread_join(encoder->audio_thread, NULL);
+
+	os_sem_destroy(encoder->audio_sem);
+	encoder->audio_sem           = NULL;
+	encoder->audio_thread_active = false;
+}
+
 static void add_connection(struct obs_encoder *encoder)
 {
 	struct audio_convert_info audio_info = {0};
 	struct video_scale_info   video_info = {0};
 
+	memset(&encoder->stats, 0, sizeof(encoder->stats));
+
 	if (encoder->info.type == OBS_ENCODER_AUDIO) {
+		/* joins the previous thread if it stopped itself on error */
+		stop_audio_thread(encoder);
+
+		if (!start_audio_thread(encoder))
+			blog(LOG_WARNING, "Failed to create audio encode thread "
+					"for encoder '%s', encoding on the audio "
+					"thread instead", encoder->context.name);
+
 		get_audio_info(encoder, &audio_info);
 		audio_output_connect(encoder->media, &audio_info, receive_audio,
 				encoder);
@@ -174,25 +224,36 @@ static void add_connection(struct obs_encoder *encoder)
 	encoder->active = true;
 }
 
+static inline bool on_audio_thread(const struct obs_encoder *encoder)
+{
+	return encoder->audio_thread_active &&
+		pthread_equal(pthread_self(), encoder->audio_thread);
+}
+
 static void remove_connection(struct obs_encoder *encoder)
 {
-	if (encoder->info.type == OBS_ENCODER_AUDIO)
+	if (encoder->info.type == OBS_ENCODER_AUDIO) {
 		audio_output_disconnect(encoder->media, receive_audio,
 				encoder);
-	else
+
+		/* an encode error stops the encoder from its own thread, which
+		 * can't join itself.  it exits on its own and is joined the
+		 * next time the encoder starts or when it's destroyed */
+		if (on_audio_thread(encoder))
+			encoder->audio_thread_exit = true;
+		else
+			stop_audio_thread(encoder);
+	} else {
 		video_output_disconnect(encoder->media, receive_video,
 				encoder);
+	}
 
 	encoder->active = false;
 }
 
 static inline void free_audio_buffers(struct obs_encoder *encoder)
 {
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		circlebuf_free(&encoder->audio_input_buffer[i]);
-		bfree(encoder->audio_output_buffer[i]);
-		encoder->audio_output_buffer[i] = NULL;
-	}
+	audio_framer_free(&encoder->audio_framer);
 }
 
 static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
@@ -208,6 +269,7 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 
 		blog(LOG_INFO, "encoder '%s' destroyed", encoder->context.name);
 
+		stop_audio_thread(encoder);
 		free_audio_buffers(encoder);
 
 		if (encoder->context.data)
@@ -215,6 +277,8 @@ static void obs_encoder_actually_destroy(obs_encoder_t *encoder)
 		da_free(encoder->callbacks);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		pthread_mutex_destroy(&encoder->update_mutex);
+		pthread_mutex_destroy(&encoder->audio_mutex);
 		obs_context_data_free(&encoder->context);
 		bfree(encoder);
 	}
@@ -289,11 +353,19 @@ void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings)
 {
 	if (!encoder) return;
 
+	pthread_mutex_lock(&encoder->update_mutex);
+
 	obs_data_apply(encoder->context.settings, settings);
 
-	if (encoder->info.update && encoder->context.data)
+	/* never call update while the encoder thread could be encoding,
+	 * leave it to the encoder thread to apply before the next frame */
+	if (encoder->active)
+		encoder->update_pending = true;
+	else if (encoder->info.update && encoder->context.data)
 		encoder->info.update(encoder->context.data,
 				encoder->context.settings);
+
+	pthread_mutex_unlock(&encoder->update_mutex);
 }
 
 bool obs_encoder_get_extra_data(const obs_encoder_t *encoder,
@@ -306,6 +378,124 @@ bool obs_encoder_get_extra_data(const obs_encoder_t *encoder,
 	return false;
 }
 
+bool obs_encoder_set_bitrate(obs_encoder_t *encoder, uint32_t kbps)
+{
+	if (!encoder || !encoder->info.update_bitrate)
+		return false;
+
+	encoder->requested_bitrate = (long)kbps;
+	return true;
+}
+
+bool obs_encoder_request_keyframe(obs_encoder_t *encoder)
+{
+	if (!encoder || encoder->info.type != OBS_ENCODER_VIDEO)
+		return false;
+	if ((encoder->info.caps & OBS_ENCODER_CAP_KEYFRAME_REQUEST) == 0)
+		return false;
+
+	encoder->keyframe_requested = true;
+	return true;
+}
+
+static int cmp_uint64(const void *a, const void *b)
+{
+	uint64_t val_a = *(const uint64_t*)a;
+	uint64_t val_b = *(const uint64_t*)b;
+	return (val_a > val_b) - (val_a < val_b);
+}
+
+static void get_percentiles(const uint64_t *samples, uint64_t count,
+		uint64_t *p50, uint64_t *p99)
+{
+	uint64_t sorted[ENCODER_STAT_SAMPLES];
+	size_t num = count < ENCODER_STAT_SAMPLES ?
+		(size_t)count : ENCODER_STAT_SAMPLES;
+
+	*p50 = 0;
+	*p99 = 0;
+
+	if (!num)
+		return;
+
+	memcpy(sorted, samples, num * sizeof(uint64_t));
+	qsort(sorted, num, sizeof(uint64_t), cmp_uint64);
+
+	*p50 = sorted[(num - 1) * 50 / 100];
+	*p99 = sorted[(num - 1) * 99 / 100];
+}
+
+static uint64_t get_bytes_per_sec(const struct encoder_stats *stats)
+{
+	size_t num = stats->packets < ENCODER_STAT_SAMPLES ?
+		(size_t)stats->packets : ENCODER_STAT_SAMPLES;
+	size_t first = (size_t)((stats->packets - num) % ENCODER_STAT_SAMPLES);
+	size_t last = (size_t)((stats->packets - 1) % ENCODER_STAT_SAMPLES);
+	uint64_t duration;
+	uint64_t bytes = 0;
+
+	if (num < 2)
+		return 0;
+
+	duration = stats->packet_ts[last] - stats->packet_ts[first];
+	if (!duration)
+		return 0;
+
+	/* the first packet marks the start of the window */
+	for (size_t i = 1; i < num; i++)
+		bytes += stats->packet_size[(first + i) % ENCODER_STAT_SAMPLES];
+
+	return bytes * 1000000000ULL / duration;
+}
+
+bool obs_encoder_get_stats(const obs_encoder_t *encoder,
+		struct obs_encoder_stats *stats)
+{
+	const struct encoder_stats *es;
+
+	if (!encoder || !stats)
+		return false;
+
+	es = &encoder->stats;
+
+	memset(stats, 0, sizeof(struct obs_encoder_stats));
+	stats->frames           = es->encode_count;
+	stats->packets          = es->packets;
+	stats->bytes            = es->bytes;
+	stats->keyframes        = es->keyframes;
+	stats->delay_frames     = es->delay_frames;
+	stats->max_delay_frames = es->max_delay_frames;
+	stats->bytes_per_sec    = get_bytes_per_sec(es);
+
+	get_percentiles(es->encode_ns, es->encode_count,
+			&stats->encode_p50, &stats->encode_p99);
+	get_percentiles(es->latency_ns, es->latency_count,
+			&stats->latency_p50, &stats->latency_p99);
+
+	if (es->keyframes > 1 && encoder->timebase_den)
+		stats->keyframe_interval =
+			(double)(es->last_keyframe_pts -
+			         es->first_keyframe_pts) /
+			(double)(es->keyframes - 1) /
+			(double)encoder->timebase_den;
+
+	return true;
+}
+
+uint32_t obs_encoder_get_bitrate(const obs_encoder_t *encoder)
+{
+	long requested;
+
+	if (!encoder) return 0;
+
+	requested = encoder->requested_bitrate;
+	if (requested)
+		return (uint32_t)requested;
+
+	return (uint32_t)obs_data_get_int(encoder->context.settings,
+			"bitrate");
+}
+
 obs_data_t *obs_encoder_get_settings(const obs_encoder_t *encoder)
 {
 	if (!encoder) return NULL;
@@ -317,10 +507,8 @@ obs_data_t *obs_encoder_get_settings(const obs_encoder_t *encoder)
 static inline void reset_audio_buffers(struct obs_encoder *encoder)
 {
 	free_audio_buffers(encoder);
-
-	for (size_t i = 0; i < encoder->planes; i++)
-		encoder->audio_output_buffer[i] =
-			bmalloc(encoder->framesize_bytes);
+	audio_framer_init(&encoder->audio_framer, encoder->planes,
+			encoder->framesize_bytes);
 }
 
 static void intitialize_audio_encoder(struct obs_encoder *encoder)
@@ -338,6 +526,23 @@ static void intitialize_audio_encoder(struct obs_encoder *encoder)
 	reset_audio_buffers(encoder);
 }
 
+static bool outputs_accept_avcc(struct obs_encoder *encoder)
+{
+	bool accept = true;
+
+	pthread_mutex_lock(&encoder->outputs_mutex);
+	for (size_t i = 0; i < encoder->outputs.num; i++) {
+		struct obs_output *output = encoder->outputs.array[i];
+		if ((output->info.flags & OBS_OUTPUT_AVCC) == 0) {
+			accept = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&encoder->outputs_mutex);
+
+	return accept;
+}
+
 bool obs_encoder_initialize(obs_encoder_t *encoder)
 {
 	if (!encoder) return false;
@@ -348,13 +553,21 @@ bool obs_encoder_initialize(obs_encoder_t *encoder)
 	if (encoder->context.data)
 		encoder->info.destroy(encoder->context.data);
 
+	encoder->avcc = encoder->info.type == OBS_ENCODER_VIDEO &&
+		(encoder->info.caps & OBS_ENCODER_CAP_AVCC) != 0 &&
+		outputs_accept_avcc(encoder);
+
 	encoder->context.data = encoder->info.create(encoder->context.settings,
 			encoder);
 	if (!encoder->context.data)
 		return false;
 
-	encoder->paired_encoder  = NULL;
-	encoder->start_ts        = 0;
+	encoder->paired_encoder    = NULL;
+	encoder->start_ts          = 0;
+	encoder->requested_bitrate  = 0;
+	encoder->applied_bitrate    = 0;
+	encoder->update_pending     = false;
+	encoder->keyframe_requested = false;
 
 	if (encoder->info.type == OBS_ENCODER_AUDIO)
 		intitialize_audio_encoder(encoder);
@@ -383,6 +596,7 @@ void obs_encoder_start(obs_encoder_t *encoder,
 {
 	struct encoder_callback cb = {false, new_packet, param};
 	bool first   = false;
+	bool added   = false;
 
 	if (!encoder || !new_packet || !encoder->context.data) return;
 
@@ -391,14 +605,21 @@ void obs_encoder_start(obs_encoder_t *encoder,
 	first = (encoder->callbacks.num == 0);
 
 	size_t idx = get_callback_idx(encoder, new_packet, param);
-	if (idx == DARRAY_INVALID)
+	if (idx == DARRAY_INVALID) {
 		da_push_back(encoder->callbacks, &cb);
+		added = true;
+	}
 
 	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
 	if (first) {
 		encoder->cur_pts = 0;
 		add_connection(encoder);
+
+	/* a new callback on a running video encoder would otherwise have to
+	 * wait for the next regular keyframe before it gets any video */
+	} else if (added && encoder->info.type == OBS_ENCODER_VIDEO) {
+		obs_encoder_request_keyframe(encoder);
 	}
 }
 
@@ -429,6 +650,16 @@ void obs_encoder_stop(obs_encoder_t *encoder,
 	}
 }
 
+uint32_t obs_encoder_get_caps(const obs_encoder_t *encoder)
+{
+	return encoder ? encoder->info.caps : 0;
+}
+
+bool obs_encoder_avcc_enabled(const obs_encoder_t *encoder)
+{
+	return encoder ? encoder->avcc : false;
+}
+
 const char *obs_encoder_get_codec(const obs_encoder_t *encoder)
 {
 	return encoder ? encoder->info.codec : NULL;
@@ -514,6 +745,26 @@ bool obs_encoder_active(const obs_encoder_t *encoder)
 	return encoder ? encoder->active : false;
 }
 
+/* the reference count and the data are allocated together, which is what
+ * allows outputs to hold on to packets without copying them */
+static inline void alloc_packet_data(struct encoder_packet *packet,
+		size_t size)
+{
+	long *refs = bmalloc(sizeof(long) + size);
+	*refs = 1;
+
+	packet->refs = refs;
+	packet->data = (uint8_t*)(refs + 1);
+}
+
+static inline void create_packet_instance(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	*dst = *src;
+	alloc_packet_data(dst, src->size);
+	memcpy(dst->data, src->data, src->size);
+}
+
 static inline bool get_sei(const struct obs_encoder *encoder,
 		uint8_t **sei, size_t *size)
 {
@@ -524,43 +775,38 @@ static inline bool get_sei(const struct obs_encoder *encoder,
 }
 
 static void send_first_video_packet(struct obs_encoder *encoder,
-		struct encoder_callback *cb, struct encoder_packet *packet)
+		struct encoder_callback *cb, struct encoder_packet *packet,
+		struct encoder_packet *first_packet)
 {
-	struct encoder_packet first_packet;
-	DARRAY(uint8_t)       data;
-	uint8_t               *sei;
-	size_t                size;
+	uint8_t *sei;
+	size_t  size;
 
 	/* always wait for first keyframe */
 	if (!packet->keyframe)
 		return;
 
-	da_init(data);
+	/* the SEI-prefixed keyframe is built once and shared between all
+	 * callbacks that are still waiting on their first packet */
+	if (!first_packet->data && get_sei(encoder, &sei, &size)) {
+		*first_packet      = *packet;
+		first_packet->size = size + packet->size;
+		alloc_packet_data(first_packet, first_packet->size);
 
-	if (!get_sei(encoder, &sei, &size)) {
-		cb->new_packet(cb->param, packet);
-		return;
+		memcpy(first_packet->data, sei, size);
+		memcpy(first_packet->data + size, packet->data, packet->size);
 	}
 
-	da_push_back_array(data, sei, size);
-	da_push_back_array(data, packet->data, packet->size);
-
-	first_packet      = *packet;
-	first_packet.data = data.array;
-	first_packet.size = data.num;
-
-	cb->new_packet(cb->param, &first_packet);
+	cb->new_packet(cb->param, first_packet->data ? first_packet : packet);
 	cb->sent_first_packet = true;
-
-	da_free(data);
 }
 
 static inline void send_packet(struct obs_encoder *encoder,
-		struct encoder_callback *cb, struct encoder_packet *packet)
+		struct encoder_callback *cb, struct encoder_packet *packet,
+		struct encoder_packet *first_packet)
 {
 	/* include SEI in first video packet */
 	if (encoder->info.type == OBS_ENCODER_VIDEO && !cb->sent_first_packet)
-		send_first_video_packet(encoder, cb, packet);
+		send_first_video_packet(encoder, cb, packet, first_packet);
 	else
 		cb->new_packet(cb->param, packet);
 }
@@ -575,18 +821,139 @@ static void full_stop(struct obs_encoder *encoder)
 	}
 }
 
+static void apply_bitrate(struct obs_encoder *encoder, long bitrate)
+{
+	bool success;
+
+	/* a request of 0 goes back to whatever is in the settings */
+	if (bitrate) {
+		success = encoder->info.update_bitrate(encoder->context.data,
+				(uint32_t)bitrate);
+	} else {
+		pthread_mutex_lock(&encoder->update_mutex);
+		success = encoder->info.update &&
+			encoder->info.update(encoder->context.data,
+					encoder->context.settings);
+		pthread_mutex_unlock(&encoder->update_mutex);
+	}
+
+	if (!success) {
+		blog(LOG_WARNING, "Failed to change bitrate of encoder '%s' "
+				"to %ld kbps", encoder->context.name, bitrate);
+
+		/* withdraw the request (unless a newer one has come in) so it
+		 * isn't retried every frame, and so obs_encoder_get_bitrate
+		 * keeps reporting the bitrate that is actually in use */
+		os_atomic_compare_swap_long(&encoder->requested_bitrate,
+				bitrate, encoder->applied_bitrate);
+		return;
+	}
+
+	encoder->applied_bitrate = bitrate;
+}
+
+static inline uint64_t pts_to_ns(const struct obs_encoder *encoder,
+		int64_t pts)
+{
+	uint64_t den = encoder->timebase_den;
+	uint64_t val = pts > 0 ? (uint64_t)pts : 0;
+
+	return val / den * 1000000000ULL + val % den * 1000000000ULL / den;
+}
+
+static void add_packet_stats(struct obs_encoder *encoder,
+		const struct encoder_frame *frame,
+		const struct encoder_packet *packet, uint64_t time)
+{
+	struct encoder_stats *stats = &encoder->stats;
+	size_t idx = (size_t)(stats->packets % ENCODER_STAT_SAMPLES);
+	int64_t frame_duration = encoder->info.type == OBS_ENCODER_VIDEO ?
+		(int64_t)encoder->timebase_num : (int64_t)encoder->framesize;
+
+	stats->packet_ts[idx]   = time;
+	stats->packet_size[idx] = packet->size;
+	stats->packets++;
+	stats->bytes += packet->size;
+
+	/* start_ts is the capture time of pts 0, audio only has one when
+	 * it's synced to video */
+	if (encoder->start_ts) {
+		uint64_t captured = encoder->start_ts +
+			pts_to_ns(encoder, packet->pts);
+
+		idx = (size_t)(stats->latency_count++ % ENCODER_STAT_SAMPLES);
+		stats->latency_ns[idx] = time > captured ? time - captured : 0;
+	}
+
+	if (frame_duration) {
+		stats->delay_frames =
+			(int)((frame->pts - packet->pts) / frame_duration);
+		if (stats->delay_frames > stats->max_delay_frames)
+			stats->max_delay_frames = stats->delay_frames;
+	}
+
+	if (packet->keyframe) {
+		if (!stats->keyframes)
+			stats->first_keyframe_pts = packet->pts;
+		stats->last_keyframe_pts = packet->pts;
+		stats->keyframes++;
+	}
+}
+
+static void apply_settings(struct obs_encoder *encoder)
+{
+	bool success = false;
+
+	pthread_mutex_lock(&encoder->update_mutex);
+	encoder->update_pending = false;
+
+	if (encoder->info.update)
+		success = encoder->info.update(encoder->context.data,
+				encoder->context.settings);
+
+	pthread_mutex_unlock(&encoder->update_mutex);
+
+	if (!success) {
+		blog(LOG_WARNING, "Failed to apply new settings to active "
+				"encoder '%s'", encoder->context.name);
+		return;
+	}
+
+	/* the settings carry their own bitrate, keep any bitrate override */
+	if (encoder->applied_bitrate)
+		apply_bitrate(encoder, encoder->applied_bitrate);
+}
+
 static inline void do_encode(struct obs_encoder *encoder,
 		struct encoder_frame *frame)
 {
 	struct encoder_packet pkt = {0};
+	long bitrate;
 	bool received = false;
 	bool success;
+	uint64_t start, end;
+
+	if (encoder->update_pending)
+		apply_settings(encoder);
+
+	bitrate = encoder->requested_bitrate;
+	if (bitrate != encoder->applied_bitrate)
+		apply_bitrate(encoder, bitrate);
+
+	if (encoder->keyframe_requested) {
+		encoder->keyframe_requested = false;
+		frame->force_keyframe = true;
+	}
 
 	pkt.timebase_num = encoder->timebase_num;
 	pkt.timebase_den = encoder->timebase_den;
+	pkt.encoder      = encoder;
 
+	start = os_gettime_ns();
 	success = encoder->info.encode(encoder->context.data, frame, &pkt,
 			&received);
+	end = os_gettime_ns();
+
 	if (!success) {
 		full_stop(encoder);
 		blog(LOG_ERROR, "Error encoding with encoder '%s'",
@@ -594,20 +961,37 @@ static inline void do_encode(struct obs_encoder *encoder,
 		return;
 	}
 
+	encoder->stats.encode_ns[encoder->stats.encode_count++ %
+		ENCODER_STAT_SAMPLES] = end - start;
+
+	if (received)
+		add_packet_stats(encoder, frame, &pkt, end);
+
 	if (received) {
+		struct encoder_packet out;
+		struct encoder_packet first_packet = {0};
+
 		/* we use system time here to ensure sync with other encoders,
 		 * you do not want to use relative timestamps here */
 		pkt.dts_usec = encoder->start_ts / 1000 + packet_dts_usec(&pkt);
+		pkt.avcc     = pkt.type == OBS_ENCODER_VIDEO && encoder->avcc;
+
+		/* the encoder's buffer is only valid until the next encode
+		 * call, so copy it once and let the outputs share it */
+		create_packet_instance(&out, &pkt);
 
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
 		for (size_t i = 0; i < encoder->callbacks.num; i++) {
 			struct encoder_callback *cb;
 			cb = encoder->callbacks.array+i;
-			send_packet(encoder, cb, &pkt);
+			send_packet(encoder, cb, &out, &first_packet);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
+
+		obs_encoder_packet_release(&first_packet);
+		obs_encoder_packet_release(&out);
 	}
 }
 
@@ -666,27 +1050,28 @@ static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
 
 	size -= offset_size;
 
-	/* push in to the circular buffer */
-	if (size)
+	/* push in to the framer */
+	if (size) {
+		uint8_t *planes[MAX_AV_PLANES];
+
 		for (size_t i = 0; i < encoder->planes; i++)
-			circlebuf_push_back(&encoder->audio_input_buffer[i],
-					data->data[i] + offset_size, size);
+			planes[i] = data->data[i] + offset_size;
+
+		audio_framer_push(&encoder->audio_framer, planes, size);
+	}
 
 	return true;
 }
 
-static void send_audio_data(struct obs_encoder *encoder)
+static void send_audio_data(struct obs_encoder *encoder,
+		uint8_t *frame[MAX_AV_PLANES])
 {
 	struct encoder_frame  enc_frame;
 
 	memset(&enc_frame, 0, sizeof(struct encoder_frame));
 
 	for (size_t i = 0; i < encoder->planes; i++) {
-		circlebuf_pop_front(&encoder->audio_input_buffer[i],
-				encoder->audio_output_buffer[i],
-				encoder->framesize_bytes);
-
-		enc_frame.data[i]     = encoder->audio_output_buffer[i];
+		enc_frame.data[i]     = frame[i];
 		enc_frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
 	}
 
@@ -698,15 +1083,65 @@ static void send_audio_data(struct obs_encoder *encoder)
 	encoder->cur_pts += encoder->framesize;
 }
 
+/* frames point in to the framer's buffer, which stays valid while more
+ * audio is pushed, so the lock isn't held while encoding */
+static void encode_audio_frames(struct obs_encoder *encoder)
+{
+	uint8_t *frame[MAX_AV_PLANES];
+
+	while (!encoder->audio_thread_exit) {
+		bool available;
+
+		pthread_mutex_lock(&encoder->audio_mutex);
+		available = audio_framer_peek(&encoder->audio_framer, frame);
+		pthread_mutex_unlock(&encoder->audio_mutex);
+
+		if (!available)
+			break;
+
+		send_audio_data(encoder, frame);
+
+		pthread_mutex_lock(&encoder->audio_mutex);
+		audio_framer_pop(&encoder->audio_framer);
+		pthread_mutex_unlock(&encoder->audio_mutex);
+	}
+}
+
+static void *audio_encode_thread(void *data)
+{
+	struct obs_encoder *encoder = data;
+
+	while (os_sem_wait(encoder->audio_sem) == 0) {
+		if (encoder->audio_thread_exit)
+			break;
+
+		encode_audio_frames(encoder);
+	}
+
+	return NULL;
+}
+
 static void receive_audio(void *param, struct audio_data *data)
 {
 	struct obs_encoder *encoder = param;
+	bool buffered;
+	bool frame_ready;
+
+	pthread_mutex_lock(&encoder->audio_mutex);
+	buffered    = buffer_audio(encoder, data);
+	frame_ready = audio_framer_size(&encoder->audio_framer) >=
+		encoder->framesize_bytes;
+	pthread_mutex_unlock(&encoder->audio_mutex);
 
-	if (!buffer_audio(encoder, data))
+	if (!buffered || !frame_ready)
 		return;
 
-	while (encoder->audio_input_buffer[0].size >= encoder->framesize_bytes)
-		send_audio_data(encoder);
+	if (encoder->audio_thread_active) {
+		os_sem_post(encoder->audio_sem);
+		return;
+	}
+
+	encode_audio_frames(encoder);
 }
 
 void obs_encoder_add_output(struct obs_encoder *encoder,
@@ -729,11 +1164,33 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+bool obs_encoder_has_other_active_outputs(const obs_encoder_t *encoder,
+		const obs_output_t *output)
+{
+	struct obs_encoder *enc = (struct obs_encoder*)encoder;
+	bool found = false;
+
+	if (!enc) return false;
+
+	pthread_mutex_lock(&enc->outputs_mutex);
+	for (size_t i = 0; i < enc->outputs.num; i++) {
+		struct obs_output *other = enc->outputs.array[i];
+		if (other != output && obs_output_active(other)) {
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&enc->outputs_mutex);
+
+	return found;
+}
+
 void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
 	*dst = *src;
 	dst->data = bmemdup(src->data, src->size);
+	dst->refs = NULL;
 }
 
 void obs_free_encoder_packet(struct encoder_packet *packet)
@@ -741,3 +1198,30 @@ void obs_free_encoder_packet(struct encoder_packet *packet)
 	bfree(packet->data);
 	memset(packet, 0, sizeof(struct encoder_packet));
 }
+
+void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	if (!dst || !src)
+		return;
+
+	if (src->refs) {
+		os_atomic_inc_long(src->refs);
+		*dst = *src;
+	} else {
+		/* not shared (a header packet, or one built by a plugin), so
+		 * make a copy that can be shared from here on */
+		create_packet_instance(dst, src);
+	}
+}
+
+void obs_encoder_packet_release(struct encoder_packet *packet)
+{
+	if (!packet)
+		return;
+
+	if (packet->refs && os_atomic_dec_long(packet->refs) == 0)
+		bfree((void*)packet->refs);
+
+	memset(packet, 0, sizeof(struct encoder_packet));
+}
@@ -25,6 +25,23 @@
  * to process output data.
  */
 
+/**
+ * Video encoder can output AVCC framed packets (each NAL unit is prefixed
+ * with its 4 byte big-endian size) instead of annex-b.  It should only do so
+ * when obs_encoder_avcc_enabled returns true in its create callback, which is
+ * the case when every output using the encoder sets OBS_OUTPUT_AVCC.  Extra
+ * data is still expected in annex-b form, SEI data must use the same framing
+ * as the packets.  Encoders with this capability also have to fill in the
+ * keyframe, priority and drop_priority values of each packet themselves.
+ */
+#define OBS_ENCODER_CAP_AVCC (1<<0)
+
+/**
+ * Video encoder honors encoder_frame::force_keyframe, and will output an IDR
+ * for that frame (see obs_encoder_request_keyframe).
+ */
+#define OBS_ENCODER_CAP_KEYFRAME_REQUEST (1<<1)
+
 /** Specifies the encoder type */
 enum obs_encoder_type {
 	OBS_ENCODER_AUDIO, /**< The encoder provides an audio codec */
@@ -67,6 +84,24 @@ struct encoder_packet {
 	 * priority or higher to continue transmission.
 	 */
 	int                   drop_priority;
+
+	/**
+	 * Video only: the NAL units are AVCC framed rather than annex-b (see
+	 * OBS_ENCODER_CAP_AVCC)
+	 */
+	bool                  avcc;
+
+	/** Audio track index (used with multi-track outputs) */
+	size_t                track_idx;
+
+	/** Encoder from which the packet originated */
+	struct obs_encoder    *encoder;
+
+	/**
+	 * Reference count of the data, or NULL if the data is not shared.
+	 * Only set by libobs, see obs_encoder_packet_ref.
+	 */
+	volatile long         *refs;
 };
 
 /** Encoder input frame */
@@ -82,6 +117,13 @@ struct encoder_frame {
 
 	/** Presentation timestamp */
 	int64_t               pts;
+
+	/**
+	 * Video only:  The frame should be encoded as a keyframe (IDR), set
+	 * when obs_encoder_request_keyframe was called.  Only passed to
+	 * encoders with OBS_ENCODER_CAP_KEYFRAME_REQUEST.
+	 */
+	bool                  force_keyframe;
 };
 
 /**
@@ -170,6 +212,11 @@ struct obs_encoder_info {
 	 * Updates the settings for this encoder (usually used for things like
 	 * changeing birate while active)
 	 *
+	 * While the encoder is active this is always called from the encoder
+	 * thread between calls to encode, and should only apply the settings
+	 * that can change without restarting the encoder (bitrate, buffer
+	 * size, rate factor and the like).
+	 *
 	 * @param  data      Data associated with this encoder context
 	 * @param  settings  New settings for this encoder
 	 * @return           true if successful, false otherwise
@@ -217,6 +264,20 @@ struct obs_encoder_info {
 	 *                    otherwise
 	 */
 	bool (*get_video_info)(void *data, struct video_scale_info *info);
+
+	/**
+	 * Changes the target bitrate while the encoder is active, without
+	 * changing any of the other settings.  Always called from the encoder
+	 * thread between calls to encode.
+	 *
+	 * @param  data     Data associated with this encoder context
+	 * @param  bitrate  New bitrate in kbps
+	 * @return          true if successful, false otherwise
+	 */
+	bool (*update_bitrate)(void *data, uint32_t bitrate);
+
+	/** Encoder capability flags (OBS_ENCODER_CAP_*) */
+	uint32_t caps;
 };
 
 EXPORT void obs_register_encoder_s(const struct obs_encoder_info *info,
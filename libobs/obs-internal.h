@@ -31,6 +31,7 @@
 #include "media-io/audio-resampler.h"
 #include "media-io/video-io.h"
 #include "media-io/audio-io.h"
+#include "media-io/audio-framer.h"
 
 #include "obs.h"
 
@@ -42,6 +43,84 @@ static inline int64_t packet_dts_usec(struct encoder_packet *packet)
 	return packet->dts * MICROSECOND_DEN / packet->timebase_den;
 }
 
+/* ------------------------------------------------------------------------- */
+/* timing statistics */
+
+#define TIMING_WINDOW_NS 1000000000ULL
+#define TIMING_STALE_NS  (TIMING_WINDOW_NS * 2)
+
+struct timing_stat {
+	uint64_t                        window_start;
+	uint64_t                        total;
+	uint64_t                        max;
+	uint32_t                        count;
+
+	/* results of the last completed window */
+	uint64_t                        avg_ns;
+	uint64_t                        max_ns;
+};
+
+static inline void timing_stat_add(struct timing_stat *stat, uint64_t start,
+		uint64_t end)
+{
+	uint64_t duration = end - start;
+
+	if (!stat->window_start)
+		stat->window_start = start;
+
+	stat->total += duration;
+	stat->count++;
+	if (duration > stat->max)
+		stat->max = duration;
+
+	if (end - stat->window_start >= TIMING_WINDOW_NS) {
+		stat->avg_ns       = stat->total / stat->count;
+		stat->max_ns       = stat->max;
+		stat->window_start = end;
+		stat->total        = 0;
+		stat->max          = 0;
+		stat->count        = 0;
+	}
+}
+
+/* windows only complete when a sample comes in, so results are treated as
+ * expired if no window has completed recently (the source stopped rendering
+ * or producing audio).  window_start is the end of the last window */
+static inline void timing_stat_get(const struct timing_stat *stat,
+		uint64_t now, uint64_t *avg, uint64_t *max)
+{
+	uint64_t window_start = stat->window_start;
+
+	if (now > window_start && now - window_start >= TIMING_STALE_NS) {
+		*avg = 0;
+		*max = 0;
+	} else {
+		*avg = stat->avg_ns;
+		*max = stat->max_ns;
+	}
+}
+
+/* encoder statistics, percentiles are taken over the last
+ * ENCODER_STAT_SAMPLES frames/packets */
+#define ENCODER_STAT_SAMPLES 512
+
+struct encoder_stats {
+	uint64_t                        encode_ns[ENCODER_STAT_SAMPLES];
+	uint64_t                        latency_ns[ENCODER_STAT_SAMPLES];
+	uint64_t                        packet_ts[ENCODER_STAT_SAMPLES];
+	size_t                          packet_size[ENCODER_STAT_SAMPLES];
+	uint64_t                        encode_count;
+	uint64_t                        latency_count;
+
+	uint64_t                        packets;
+	uint64_t                        bytes;
+	uint64_t                        keyframes;
+	int64_t                         first_keyframe_pts;
+	int64_t                         last_keyframe_pts;
+	int                             delay_frames;
+	int                             max_delay_frames;
+};
+
 struct draw_callback {
 	void (*draw)(void *param, uint32_t cx, uint32_t cy);
 	void *param;
@@ -148,10 +227,37 @@ struct obs_core_video {
 	gs_stagesurf_t                  *mapped_surface;
 	int                             cur_texture;
 
+	uint64_t                        last_timing_log;
+
+	/* referenced copy of the tick list for the current tick */
+	DARRAY(struct obs_source*)      tick_snapshot;
+
 	video_t                         *video;
 	pthread_t                       video_thread;
 	bool                            thread_initialized;
 
+	/* workers for sources with OBS_SOURCE_THREADED_TICK.  jobs are
+	 * claimed through tick_job_idx so idle workers pick up whatever is
+	 * left rather than being assigned a fixed share */
+	pthread_t                       *tick_threads;
+	size_t                          num_tick_threads;
+	os_sem_t                        *tick_start_sem;
+	os_sem_t                        *tick_done_sem;
+	DARRAY(struct obs_source*)      tick_jobs;
+	volatile long                   tick_job_idx;
+	float                           tick_seconds;
+	volatile bool                   tick_threads_exit;
+
+	/* sources whose last reference is dropped by the video thread when it
+	 * releases the tick snapshot are destroyed here instead, so that the
+	 * render loop never waits on a source's destroy callback */
+	pthread_t                       destroy_thread;
+	bool                            destroy_thread_active;
+	volatile bool                   destroy_thread_exit;
+	os_sem_t                        *destroy_sem;
+	pthread_mutex_t                 destroy_mutex;
+	DARRAY(struct obs_source*)      destroy_list;
+
 	bool                            gpu_conversion;
 	const char                      *conversion_tech;
 	uint32_t                        conversion_height;
@@ -192,6 +298,13 @@ struct obs_core_data {
 	pthread_mutex_t                 encoders_mutex;
 	pthread_mutex_t                 services_mutex;
 
+	/* flat list of sources ticked each frame by the video thread.  kept
+	 * separate from the source list so ticking doesn't have to hold
+	 * sources_mutex or walk the linked list.  the video thread only holds
+	 * tick_mutex while copying the list, not while ticking */
+	pthread_mutex_t                 tick_mutex;
+	DARRAY(struct obs_source*)      tick_list;
+
 	struct obs_view                 main_view;
 
 	long long                       unnamed_index;
@@ -228,6 +341,12 @@ extern struct obs_core *obs;
 
 extern void *obs_video_thread(void *param);
 
+extern bool obs_init_tick_threads(void);
+extern void obs_free_tick_threads(void);
+
+extern bool obs_init_destroy_thread(void);
+extern void obs_free_destroy_thread(void);
+
 
 /* ------------------------------------------------------------------------- */
 /* obs shared context data */
@@ -300,6 +419,16 @@ struct obs_source {
 	uint64_t                        last_sys_timestamp;
 	bool                            async_rendered;
 
+	/* async presentation clock and judder statistics */
+	int64_t                         async_pll_integral;
+	uint64_t                        async_frame_interval;
+	uint64_t                        async_last_input_ts;
+	uint64_t                        async_shown_ts;
+	uint64_t                        async_pts_error;
+	uint32_t                        async_frames_shown;
+	uint32_t                        async_frames_repeated;
+	uint32_t                        async_frames_dropped;
+
 	/* audio */
 	bool                            audio_failed;
 	struct resample_info            sample_info;
@@ -351,6 +480,21 @@ struct obs_source {
 	pthread_mutex_t                 filter_mutex;
 	gs_texrender_t                  *filter_texrender;
 	bool                            rendering_filter;
+
+	/* duration of the last video_tick in nanoseconds */
+	volatile uint64_t               tick_time;
+
+	/* timing statistics */
+	struct timing_stat              tick_timing;
+	struct timing_stat              render_timing;
+	struct timing_stat              async_video_timing;
+	struct timing_stat              audio_timing;
+
+	/* render cache (OBS_SOURCE_CACHEABLE) */
+	gs_texrender_t                  *render_cache;
+	uint32_t                        render_cache_cx;
+	uint32_t                        render_cache_cy;
+	bool                            render_cache_dirty;
 };
 
 extern const struct obs_source_info *find_source(struct darray *list,
@@ -382,11 +526,13 @@ struct obs_output {
 	bool                            received_video;
 	bool                            received_audio;
 	int64_t                         video_offset;
-	int64_t                         audio_offset;
-	int64_t                         highest_audio_ts;
+	int64_t                         audio_offsets[MAX_OUTPUT_AUDIO_ENCODERS];
+	int64_t                         highest_audio_ts[MAX_OUTPUT_AUDIO_ENCODERS];
 	int64_t                         highest_video_ts;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	struct circlebuf                interleaved_video;
+	struct circlebuf                interleaved_audio[MAX_OUTPUT_AUDIO_ENCODERS];
+	bool                            interleave_overflow;
 
 	int                             reconnect_retry_sec;
 	int                             reconnect_retry_max;
@@ -405,7 +551,7 @@ struct obs_output {
 	video_t                         *video;
 	audio_t                         *audio;
 	obs_encoder_t                   *video_encoder;
-	obs_encoder_t                   *audio_encoder;
+	obs_encoder_t                   *audio_encoders[MAX_OUTPUT_AUDIO_ENCODERS];
 	obs_service_t                   *service;
 
 	uint32_t                        scaled_width;
@@ -449,13 +595,43 @@ struct obs_encoder {
 
 	bool                            active;
 
+	/* whether video packets are AVCC framed, only changes when the
+	 * encoder is (re)initialized */
+	bool                            avcc;
+
 	uint32_t                        timebase_num;
 	uint32_t                        timebase_den;
 
 	int64_t                         cur_pts;
 
-	struct circlebuf                audio_input_buffer[MAX_AV_PLANES];
-	uint8_t                         *audio_output_buffer[MAX_AV_PLANES];
+	/* requested_bitrate is set from any thread by
+	 * obs_encoder_set_bitrate, applied_bitrate is only touched by the
+	 * encoder thread when it hands the new bitrate to the encoder */
+	volatile long                   requested_bitrate;
+	long                            applied_bitrate;
+
+	/* settings changed with obs_encoder_update while active are applied
+	 * by the encoder thread before the next frame, update_mutex keeps the
+	 * two from touching the settings at the same time */
+	pthread_mutex_t                 update_mutex;
+	volatile bool                   update_pending;
+	volatile bool                   keyframe_requested;
+
+	struct audio_framer             audio_framer;
+
+	/* only written by the encoder thread, like the source timing stats
+	 * they're read without a lock */
+	struct encoder_stats            stats;
+
+	/* audio is only buffered on the audio thread, each audio encoder
+	 * encodes it on its own thread so that several audio encoders don't
+	 * add up on the audio thread.  audio_mutex protects the framer, but
+	 * a frame can be encoded without holding it */
+	pthread_mutex_t                 audio_mutex;
+	os_sem_t                        *audio_sem;
+	pthread_t                       audio_thread;
+	bool                            audio_thread_active;
+	volatile bool                   audio_thread_exit;
 
 	/* if a video encoder is paired with an audio encoder, make it start
 	 * up at the specific timestamp.  if this is the audio encoder,
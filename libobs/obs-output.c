@@ -19,6 +19,7 @@
 #include "util/platform.h"
 #include "obs.h"
 #include "obs-internal.h"
+#include "obs-avc.h"
 
 static inline void signal_stop(struct obs_output *output, int code);
 
@@ -107,11 +108,22 @@ fail:
 	return NULL;
 }
 
+static inline void free_packet_queue(struct circlebuf *queue)
+{
+	while (queue->size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(queue, &packet, sizeof(packet));
+		obs_encoder_packet_release(&packet);
+	}
+
+	circlebuf_free(queue);
+}
+
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_free_encoder_packet(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
+	free_packet_queue(&output->interleaved_video);
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++)
+		free_packet_queue(&output->interleaved_audio[i]);
 }
 
 void obs_output_destroy(obs_output_t *output)
@@ -135,9 +147,11 @@ void obs_output_destroy(obs_output_t *output)
 			obs_encoder_remove_output(output->video_encoder,
 					output);
 		}
-		if (output->audio_encoder) {
-			obs_encoder_remove_output(output->audio_encoder,
-					output);
+		for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+			if (output->audio_encoders[i])
+				obs_encoder_remove_output(
+						output->audio_encoders[i],
+						output);
 		}
 
 		pthread_mutex_destroy(&output->interleaved_mutex);
@@ -204,6 +218,43 @@ static void log_frame_info(struct obs_output *output)
 	}
 }
 
+static void log_encoder_stats(struct obs_output *output,
+		obs_encoder_t *encoder)
+{
+	struct obs_encoder_stats stats;
+
+	if (!obs_encoder_get_stats(encoder, &stats) || !stats.packets)
+		return;
+
+	blog(LOG_INFO, "Output '%s': Encoder '%s': encode time p50/p99: "
+			"%.2f/%.2f ms, latency p50/p99: %.1f/%.1f ms, "
+			"delay: %d frames (max %d)",
+			output->context.name, obs_encoder_get_name(encoder),
+			(double)stats.encode_p50 / 1000000.0,
+			(double)stats.encode_p99 / 1000000.0,
+			(double)stats.latency_p50 / 1000000.0,
+			(double)stats.latency_p99 / 1000000.0,
+			stats.delay_frames, stats.max_delay_frames);
+
+	blog(LOG_INFO, "Output '%s': Encoder '%s': %"PRIu64" frames, "
+			"%"PRIu64" packets, %"PRIu64" kb/s, "
+			"keyframe interval: %.2f s",
+			output->context.name, obs_encoder_get_name(encoder),
+			stats.frames, stats.packets,
+			stats.bytes_per_sec * 8 / 1000,
+			stats.keyframe_interval);
+}
+
+static void log_encoders_stats(struct obs_output *output)
+{
+	if (output->video_encoder)
+		log_encoder_stats(output, output->video_encoder);
+
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++)
+		if (output->audio_encoders[i])
+			log_encoder_stats(output, output->audio_encoders[i]);
+}
+
 void obs_output_stop(obs_output_t *output)
 {
 	if (output) {
@@ -216,6 +267,8 @@ void obs_output_stop(obs_output_t *output)
 
 		if (output->video)
 			log_frame_info(output);
+		if ((output->info.flags & OBS_OUTPUT_ENCODED) != 0)
+			log_encoders_stats(output);
 	}
 }
 
@@ -331,10 +384,15 @@ void obs_output_remove_encoder(struct obs_output *output,
 {
 	if (!output) return;
 
-	if (output->video_encoder == encoder)
+	if (output->video_encoder == encoder) {
 		output->video_encoder = NULL;
-	else if (output->audio_encoder == encoder)
-		output->audio_encoder = NULL;
+		return;
+	}
+
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (output->audio_encoders[i] == encoder)
+			output->audio_encoders[i] = NULL;
+	}
 }
 
 void obs_output_set_video_encoder(obs_output_t *output, obs_encoder_t *encoder)
@@ -353,15 +411,59 @@ void obs_output_set_video_encoder(obs_output_t *output, obs_encoder_t *encoder)
 				output->scaled_width, output->scaled_height);
 }
 
+static void set_audio_encoder(struct obs_output *output,
+		struct obs_encoder *encoder, size_t track)
+{
+	/* packets are matched to tracks by encoder, so an encoder can only
+	 * be used for one track of an output */
+	for (size_t i = 0; encoder && i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (i != track && output->audio_encoders[i] == encoder) {
+			blog(LOG_WARNING, "output '%s': Encoder '%s' is "
+			                  "already used for audio track %d",
+			                  obs_output_get_name(output),
+			                  obs_encoder_get_name(encoder),
+			                  (int)i);
+			return;
+		}
+	}
+
+	obs_encoder_remove_output(output->audio_encoders[track], output);
+	obs_encoder_add_output(encoder, output);
+	output->audio_encoders[track] = encoder;
+}
+
 void obs_output_set_audio_encoder(obs_output_t *output, obs_encoder_t *encoder)
 {
 	if (!output) return;
-	if (output->audio_encoder == encoder) return;
+	if (output->audio_encoders[0] == encoder) return;
 	if (encoder && encoder->info.type != OBS_ENCODER_AUDIO) return;
 
-	obs_encoder_remove_output(output->audio_encoder, output);
-	obs_encoder_add_output(encoder, output);
-	output->audio_encoder = encoder;
+	set_audio_encoder(output, encoder, 0);
+}
+
+void obs_output_set_audio_track_encoder(obs_output_t *output,
+		obs_encoder_t *encoder, size_t track)
+{
+	if (!output) return;
+	if (track >= MAX_OUTPUT_AUDIO_ENCODERS) return;
+	if (output->audio_encoders[track] == encoder) return;
+	if (encoder && encoder->info.type != OBS_ENCODER_AUDIO) return;
+
+	if (track > 0 && (output->info.flags & OBS_OUTPUT_MULTI_TRACK) == 0) {
+		blog(LOG_WARNING, "output '%s': Output does not support "
+		                  "multiple audio tracks",
+		                  obs_output_get_name(output));
+		return;
+	}
+
+	if (output->active) {
+		blog(LOG_WARNING, "output '%s': Cannot change audio tracks "
+		                  "while the output is active",
+		                  obs_output_get_name(output));
+		return;
+	}
+
+	set_audio_encoder(output, encoder, track);
 }
 
 obs_encoder_t *obs_output_get_video_encoder(const obs_output_t *output)
@@ -371,7 +473,31 @@ obs_encoder_t *obs_output_get_video_encoder(const obs_output_t *output)
 
 obs_encoder_t *obs_output_get_audio_encoder(const obs_output_t *output)
 {
-	return output ? output->audio_encoder : NULL;
+	return output ? output->audio_encoders[0] : NULL;
+}
+
+obs_encoder_t *obs_output_get_audio_track_encoder(const obs_output_t *output,
+		size_t track)
+{
+	if (!output || track >= MAX_OUTPUT_AUDIO_ENCODERS)
+		return NULL;
+
+	return output->audio_encoders[track];
+}
+
+size_t obs_output_get_num_audio_tracks(const obs_output_t *output)
+{
+	size_t num = 0;
+
+	if (!output)
+		return 0;
+
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (output->audio_encoders[i])
+			num++;
+	}
+
+	return num;
 }
 
 void obs_output_set_service(obs_output_t *output, obs_service_t *service)
@@ -502,7 +628,7 @@ static bool can_begin_data_capture(const struct obs_output *output,
 
 	if (has_audio) {
 		if (encoded) {
-			if (!output->audio_encoder)
+			if (!output->audio_encoders[0])
 				return false;
 		} else {
 			if (!output->audio)
@@ -561,6 +687,17 @@ static inline struct audio_convert_info *get_audio_conversion(
 	return output->audio_conversion_set ? &output->audio_conversion : NULL;
 }
 
+static size_t get_track_index(const struct obs_output *output,
+		const struct encoder_packet *packet)
+{
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (output->audio_encoders[i] == packet->encoder)
+			return i;
+	}
+
+	return 0;
+}
+
 static void apply_interleaved_packet_offset(struct obs_output *output,
 		struct encoder_packet *out)
 {
@@ -570,17 +707,8 @@ static void apply_interleaved_packet_offset(struct obs_output *output,
 	 * may not currently be at 0 when we get data.  so, we store the
 	 * current dts as offset and subtract that value from the dts/pts
 	 * of the output packet. */
-	if (out->type == OBS_ENCODER_VIDEO) {
-		if (!output->received_video)
-			output->received_video = true;
-
-		offset = output->video_offset;
-	} else {
-		if (!output->received_audio)
-			output->received_audio = true;
-
-		offset = output->audio_offset;
-	}
+	offset = (out->type == OBS_ENCODER_VIDEO) ?
+		output->video_offset : output->audio_offsets[out->track_idx];
 
 	out->dts -= offset;
 	out->pts -= offset;
@@ -594,162 +722,206 @@ static void apply_interleaved_packet_offset(struct obs_output *output,
 	out->dts_usec = packet_dts_usec(out);
 }
 
-static inline bool has_higher_opposing_ts(struct obs_output *output,
-		struct encoder_packet *packet)
+/* maximum duration of audio held in the interleave buffer while waiting on
+ * video before the oldest audio packets start getting dropped */
+#define MAX_INTERLEAVE_USEC 10000000LL
+
+static inline struct circlebuf *get_interleaved_queue(
+		struct obs_output *output, const struct encoder_packet *packet)
 {
-	if (packet->type == OBS_ENCODER_VIDEO)
-		return output->highest_audio_ts > packet->dts_usec;
-	else
-		return output->highest_video_ts > packet->dts_usec;
+	return (packet->type == OBS_ENCODER_VIDEO) ?
+		&output->interleaved_video :
+		&output->interleaved_audio[packet->track_idx];
 }
 
-static inline void send_interleaved(struct obs_output *output)
+/* returns true if every connected audio track has a packet queued */
+static bool audio_tracks_ready(const struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (output->audio_encoders[i] &&
+		    !output->interleaved_audio[i].size)
+			return false;
+	}
 
-	/* do not send an interleaved packet if there's no packet of the
-	 * opposing type of a higher timstamp in the interleave buffer.
-	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
-		return;
+	return true;
+}
 
-	if (out.type == OBS_ENCODER_VIDEO)
-		output->total_frames++;
+/* packets of each type (and each audio track) always arrive in DTS order,
+ * so the interleaved stream is just a merge of the queues.  a packet can
+ * only be sent once every other queue has a packet of an equal or higher
+ * timestamp, which ensures that the timestamps are monotonic */
+static void send_interleaved(struct obs_output *output)
+{
+	while (output->interleaved_video.size && audio_tracks_ready(output)) {
+		struct encoder_packet next;
+		struct encoder_packet out;
+		struct circlebuf      *queue = &output->interleaved_video;
 
-	da_erase(output->interleaved_packets, 0);
-	output->info.encoded_packet(output->context.data, &out);
-	obs_free_encoder_packet(&out);
+		circlebuf_peek_front(queue, &next, sizeof(next));
+
+		for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+			struct encoder_packet audio;
+
+			if (!output->audio_encoders[i])
+				continue;
+
+			circlebuf_peek_front(&output->interleaved_audio[i],
+					&audio, sizeof(audio));
+
+			if (audio.dts_usec < next.dts_usec) {
+				next  = audio;
+				queue = &output->interleaved_audio[i];
+			}
+		}
+
+		circlebuf_pop_front(queue, &out, sizeof(out));
+
+		if (out.type == OBS_ENCODER_VIDEO)
+			output->total_frames++;
+
+		output->info.encoded_packet(output->context.data, &out);
+		obs_encoder_packet_release(&out);
+	}
 }
 
 static inline void set_higher_ts(struct obs_output *output,
 		struct encoder_packet *packet)
 {
-	if (packet->type == OBS_ENCODER_VIDEO) {
-		if (output->highest_video_ts < packet->dts_usec)
-			output->highest_video_ts = packet->dts_usec;
-	} else {
-		if (output->highest_audio_ts < packet->dts_usec)
-			output->highest_audio_ts = packet->dts_usec;
-	}
+	int64_t *highest_ts = (packet->type == OBS_ENCODER_VIDEO) ?
+		&output->highest_video_ts :
+		&output->highest_audio_ts[packet->track_idx];
+
+	if (*highest_ts < packet->dts_usec)
+		*highest_ts = packet->dts_usec;
 }
 
-static bool can_prune_interleaved_packet(struct obs_output *output, size_t idx)
+/* video packets cannot be dropped without breaking the GOP, and audio only
+ * backs up like this when the video encoder is lagging or stalled, so only
+ * the audio queues are trimmed */
+static void check_interleave_duration(struct obs_output *output, size_t track)
 {
-	struct encoder_packet *packet;
-	struct encoder_packet *next;
-
-	if (idx >= (output->interleaved_packets.num - 1))
-		return false;
+	struct circlebuf *queue = &output->interleaved_audio[track];
+	int dropped = 0;
 
-	packet = &output->interleaved_packets.array[idx];
+	while (queue->size) {
+		struct encoder_packet packet;
+		circlebuf_peek_front(queue, &packet, sizeof(packet));
 
-	/* audio packets will almost always come before video packets,
-	 * so it should only ever be necessary to prune audio packets */
-	if (packet->type != OBS_ENCODER_AUDIO)
-		return false;
+		if (output->highest_audio_ts[track] - packet.dts_usec <=
+				MAX_INTERLEAVE_USEC)
+			break;
 
-	next = &output->interleaved_packets.array[idx + 1];
+		circlebuf_pop_front(queue, &packet, sizeof(packet));
+		obs_encoder_packet_release(&packet);
+		dropped++;
+	}
 
-	if (next->type == OBS_ENCODER_VIDEO &&
-	    next->dts_usec == packet->dts_usec)
-		return false;
+	if (dropped && !output->interleave_overflow) {
+		blog(LOG_WARNING, "Output '%s': No video received for more "
+		                  "than %lld ms, dropping buffered audio",
+		                  output->context.name,
+		                  MAX_INTERLEAVE_USEC / 1000);
+		output->interleave_overflow = true;
 
-	return true;
+	} else if (!dropped) {
+		output->interleave_overflow = false;
+	}
 }
 
+/* audio packets will almost always come before video packets, so it
+ * should only ever be necessary to prune audio packets */
 static void prune_interleaved_packets(struct obs_output *output)
 {
-	size_t start_idx = 0;
+	struct encoder_packet video;
 
-	while (can_prune_interleaved_packet(output, start_idx))
-		start_idx++;
+	circlebuf_peek_front(&output->interleaved_video, &video,
+			sizeof(video));
 
-	if (start_idx) {
-		for (size_t i = 0; i < start_idx; i++) {
-			struct encoder_packet *packet =
-				&output->interleaved_packets.array[i];
-			obs_free_encoder_packet(packet);
-		}
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		struct circlebuf *queue = &output->interleaved_audio[i];
 
-		da_erase_range(output->interleaved_packets, 0, start_idx);
+		while (queue->size) {
+			struct encoder_packet audio;
+			circlebuf_peek_front(queue, &audio, sizeof(audio));
+
+			if (audio.dts_usec >= video.dts_usec)
+				break;
+
+			circlebuf_pop_front(queue, &audio, sizeof(audio));
+			obs_encoder_packet_release(&audio);
+		}
 	}
 }
 
-static struct encoder_packet *find_first_packet_type(struct obs_output *output,
-		enum obs_encoder_type type)
+static void apply_queue_offset(struct obs_output *output,
+		struct circlebuf *queue)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
+	size_t num = queue->size / sizeof(struct encoder_packet);
 
-		if (packet->type == type)
-			return packet;
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(queue, &packet, sizeof(packet));
+		apply_interleaved_packet_offset(output, &packet);
+		circlebuf_push_back(queue, &packet, sizeof(packet));
 	}
-
-	return NULL;
 }
 
 static bool initialize_interleaved_packets(struct obs_output *output)
 {
-	struct encoder_packet *video;
-	struct encoder_packet *audio;
+	struct encoder_packet video;
 
-	video = find_first_packet_type(output, OBS_ENCODER_VIDEO);
-	audio = find_first_packet_type(output, OBS_ENCODER_AUDIO);
+	output->received_audio = audio_tracks_ready(output);
+	output->received_video = output->interleaved_video.size != 0;
 
-	if (!audio)
-		output->received_audio = false;
-	if (!video)
-		output->received_video = false;
-	if (!audio || !video) {
+	if (!output->received_audio || !output->received_video)
 		return false;
-	}
 
 	/* get new offsets */
-	output->video_offset = video->dts;
-	output->audio_offset = audio->dts;
+	circlebuf_peek_front(&output->interleaved_video, &video,
+			sizeof(video));
 
-	/* subtract offsets from highest TS offset variables */
-	output->highest_audio_ts -= audio->dts_usec;
-	output->highest_video_ts -= video->dts_usec;
+	output->video_offset      = video.dts;
+	output->highest_video_ts -= video.dts_usec;
 
-	/* apply new offsets to all existing packet DTS/PTS values */
-	for (size_t i = 0; i < output->interleaved_packets.num; i++) {
-		struct encoder_packet *packet =
-			&output->interleaved_packets.array[i];
-		apply_interleaved_packet_offset(output, packet);
-	}
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		struct encoder_packet audio;
 
-	return true;
-}
+		if (!output->audio_encoders[i])
+			continue;
 
-static inline void insert_interleaved_packet(struct obs_output *output,
-		struct encoder_packet *out)
-{
-	size_t idx;
-	for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-		struct encoder_packet *cur_packet;
-		cur_packet = output->interleaved_packets.array + idx;
+		circlebuf_peek_front(&output->interleaved_audio[i], &audio,
+				sizeof(audio));
 
-		if (out->dts_usec < cur_packet->dts_usec)
-			break;
+		output->audio_offsets[i]     = audio.dts;
+		output->highest_audio_ts[i] -= audio.dts_usec;
 	}
 
-	da_insert(output->interleaved_packets, idx, out);
+	/* apply new offsets to all existing packet DTS/PTS values */
+	apply_queue_offset(output, &output->interleaved_video);
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++)
+		apply_queue_offset(output, &output->interleaved_audio[i]);
+
+	return true;
 }
 
-static void resort_interleaved_packets(struct obs_output *output)
+/* the encoder only outputs AVCC when every output it had when it started
+ * accepts it, outputs added later that don't get their own annex-b copy
+ * because the shared data can't be rewritten in place */
+static inline bool needs_annexb_copy(const struct obs_output *output,
+		const struct encoder_packet *packet)
 {
-	DARRAY(struct encoder_packet) old_array;
-
-	old_array.da = output->interleaved_packets.da;
-	memset(&output->interleaved_packets, 0,
-			sizeof(output->interleaved_packets));
+	return packet->avcc && (output->info.flags & OBS_OUTPUT_AVCC) == 0;
+}
 
-	for (size_t i = 0; i < old_array.num; i++)
-		insert_interleaved_packet(output, &old_array.array[i]);
+static void annexb_packet_copy(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	struct encoder_packet tmp = *src;
 
-	da_free(old_array);
+	tmp.refs = NULL;
+	obs_encoder_packet_ref(dst, &tmp);
+	obs_avcc_to_annexb(dst->data, dst->size);
+	dst->avcc = false;
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
@@ -762,35 +934,61 @@ static void interleave_packets(void *data, struct encoder_packet *packet)
 
 	was_started = output->received_audio && output->received_video;
 
-	obs_duplicate_encoder_packet(&out, packet);
+	if (needs_annexb_copy(output, packet))
+		annexb_packet_copy(&out, packet);
+	else
+		obs_encoder_packet_ref(&out, packet);
+
+	if (out.type == OBS_ENCODER_AUDIO)
+		out.track_idx = get_track_index(output, &out);
+
 	apply_interleaved_packet_offset(output, &out);
-	insert_interleaved_packet(output, &out);
+	circlebuf_push_back(get_interleaved_queue(output, &out), &out,
+			sizeof(out));
 	set_higher_ts(output, &out);
 
-	/* when both video and audio have been received, we're ready
-	 * to start sending out packets (one at a time) */
+	if (!was_started) {
+		output->received_audio = audio_tracks_ready(output);
+		output->received_video = output->interleaved_video.size != 0;
+	}
+
+	/* when video and all audio tracks have been received, we're ready
+	 * to start sending out packets */
 	if (output->received_audio && output->received_video) {
 		if (!was_started) {
 			prune_interleaved_packets(output);
-			if (initialize_interleaved_packets(output)) {
-				resort_interleaved_packets(output);
+			if (initialize_interleaved_packets(output))
 				send_interleaved(output);
-			}
 		} else {
 			send_interleaved(output);
 		}
 	}
 
+	if (out.type == OBS_ENCODER_AUDIO)
+		check_interleave_duration(output, out.track_idx);
+
 	pthread_mutex_unlock(&output->interleaved_mutex);
 }
 
 static void default_encoded_callback(void *param, struct encoder_packet *packet)
 {
-	struct obs_output *output = param;
-	output->info.encoded_packet(output->context.data, packet);
+	struct obs_output     *output = param;
+	struct encoder_packet out     = *packet;
+	bool                  copied  = needs_annexb_copy(output, packet);
+
+	/* the packet is shared with the encoder's other callbacks, so the
+	 * track index is set on a copy */
+	if (copied)
+		annexb_packet_copy(&out, packet);
+	if (out.type == OBS_ENCODER_AUDIO)
+		out.track_idx = get_track_index(output, &out);
+
+	output->info.encoded_packet(output->context.data, &out);
 
-	if (packet->type == OBS_ENCODER_VIDEO)
+	if (out.type == OBS_ENCODER_VIDEO)
 		output->total_frames++;
+	if (copied)
+		obs_encoder_packet_release(&out);
 }
 
 static void default_raw_video_callback(void *param, struct video_data *frame)
@@ -800,6 +998,28 @@ static void default_raw_video_callback(void *param, struct video_data *frame)
 	output->total_frames++;
 }
 
+static void start_audio_encoders(struct obs_output *output,
+		void (*encoded_callback)(void *data,
+			struct encoder_packet *packet))
+{
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (output->audio_encoders[i])
+			obs_encoder_start(output->audio_encoders[i],
+					encoded_callback, output);
+	}
+}
+
+static void stop_audio_encoders(struct obs_output *output,
+		void (*encoded_callback)(void *data,
+			struct encoder_packet *packet))
+{
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		if (output->audio_encoders[i])
+			obs_encoder_stop(output->audio_encoders[i],
+					encoded_callback, output);
+	}
+}
+
 static void hook_data_capture(struct obs_output *output, bool encoded,
 		bool has_video, bool has_audio)
 {
@@ -808,12 +1028,16 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 	if (encoded) {
 		output->received_audio   = false;
 		output->received_video   = false;
-		output->highest_audio_ts = 0;
 		output->highest_video_ts = 0;
 		output->video_offset     = 0;
-		output->audio_offset     = 0;
+		memset(output->highest_audio_ts, 0,
+				sizeof(output->highest_audio_ts));
+		memset(output->audio_offsets, 0,
+				sizeof(output->audio_offsets));
 		free_packets(output);
 
+		output->interleave_overflow = false;
+
 		encoded_callback = (has_video && has_audio) ?
 			interleave_packets : default_encoded_callback;
 
@@ -821,8 +1045,7 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 			obs_encoder_start(output->video_encoder,
 					encoded_callback, output);
 		if (has_audio)
-			obs_encoder_start(output->audio_encoder,
-					encoded_callback, output);
+			start_audio_encoders(output, encoded_callback);
 	} else {
 		if (has_video)
 			video_output_connect(output->video,
@@ -899,6 +1122,38 @@ bool obs_output_can_begin_data_capture(const obs_output_t *output,
 			has_service);
 }
 
+static bool initialize_audio_encoders(struct obs_output *output)
+{
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		obs_encoder_t *audio = output->audio_encoders[i];
+
+		if (audio && !obs_encoder_initialize(audio))
+			return false;
+	}
+
+	return true;
+}
+
+/* every audio track that isn't already running for another output waits
+ * for video so that all tracks start in sync with it */
+static void pair_encoders(struct obs_output *output)
+{
+	struct obs_encoder *video = output->video_encoder;
+
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		struct obs_encoder *audio = output->audio_encoders[i];
+
+		if (!audio || audio->active)
+			continue;
+
+		audio->wait_for_video = true;
+		audio->paired_encoder = video;
+
+		if (!video->paired_encoder)
+			video->paired_encoder = audio;
+	}
+}
+
 bool obs_output_initialize_encoders(obs_output_t *output, uint32_t flags)
 {
 	bool encoded, has_video, has_audio, has_service;
@@ -915,15 +1170,11 @@ bool obs_output_initialize_encoders(obs_output_t *output, uint32_t flags)
 		return false;
 	if (has_video && !obs_encoder_initialize(output->video_encoder))
 		return false;
-	if (has_audio && !obs_encoder_initialize(output->audio_encoder))
+	if (has_audio && !initialize_audio_encoders(output))
 		return false;
 
-	if (has_video && has_audio && !output->audio_encoder->active &&
-	    !output->video_encoder->active) {
-		output->audio_encoder->wait_for_video = true;
-		output->video_encoder->paired_encoder = output->audio_encoder;
-		output->audio_encoder->paired_encoder = output->video_encoder;
-	}
+	if (has_video && has_audio && !output->video_encoder->active)
+		pair_encoders(output);
 
 	return true;
 }
@@ -980,8 +1231,7 @@ void obs_output_end_data_capture(obs_output_t *output)
 			obs_encoder_stop(output->video_encoder,
 					encoded_callback, output);
 		if (has_audio)
-			obs_encoder_stop(output->audio_encoder,
-					encoded_callback, output);
+			stop_audio_encoders(output, encoded_callback);
 	} else {
 		if (has_video)
 			video_output_disconnect(output->video,
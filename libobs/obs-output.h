@@ -22,6 +22,16 @@
 #define OBS_OUTPUT_AV          (OBS_OUTPUT_VIDEO | OBS_OUTPUT_AUDIO)
 #define OBS_OUTPUT_ENCODED     (1<<2)
 #define OBS_OUTPUT_SERVICE     (1<<3)
+#define OBS_OUTPUT_MULTI_TRACK (1<<4)
+
+/**
+ * The output accepts AVCC framed video packets (see encoder_packet::avcc).
+ * Encoders with OBS_ENCODER_CAP_AVCC only produce them when all of their
+ * outputs set this flag, other outputs are given annex-b copies.
+ */
+#define OBS_OUTPUT_AVCC        (1<<5)
+
+#define MAX_OUTPUT_AUDIO_ENCODERS 6
 
 struct encoder_packet;
 
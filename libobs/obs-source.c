@@ -25,6 +25,7 @@
 #include "callback/calldata.h"
 #include "graphics/matrix3.h"
 #include "graphics/vec3.h"
+#include "graphics/vec4.h"
 
 #include "obs.h"
 #include "obs-internal.h"
@@ -104,6 +105,29 @@ const char *obs_source_get_display_name(enum obs_source_type type,
 	return (info != NULL) ? info->get_name() : NULL;
 }
 
+static inline void add_tick_source(struct obs_source *source)
+{
+	struct obs_core_data *data = &obs->data;
+
+	pthread_mutex_lock(&data->tick_mutex);
+	da_push_back(data->tick_list, &source);
+	pthread_mutex_unlock(&data->tick_mutex);
+}
+
+static inline void remove_tick_source(struct obs_source *source)
+{
+	struct obs_core_data *data = &obs->data;
+	size_t idx;
+
+	pthread_mutex_lock(&data->tick_mutex);
+
+	idx = da_find(data->tick_list, &source, 0);
+	if (idx != DARRAY_INVALID)
+		da_erase(data->tick_list, idx);
+
+	pthread_mutex_unlock(&data->tick_mutex);
+}
+
 /* internal initialization */
 bool obs_source_init(struct obs_source *source,
 		const struct obs_source_info *info)
@@ -136,6 +160,7 @@ bool obs_source_init(struct obs_source *source,
 	obs_context_data_insert(&source->context,
 			&obs->data.sources_mutex,
 			&obs->data.first_source);
+	add_tick_source(source);
 	return true;
 }
 
@@ -223,6 +248,7 @@ void obs_source_destroy(struct obs_source *source)
 	if (!source)
 		return;
 
+	remove_tick_source(source);
 	obs_context_data_remove(&source->context);
 
 	blog(LOG_INFO, "source '%s' destroyed", source->context.name);
@@ -246,6 +272,7 @@ void obs_source_destroy(struct obs_source *source)
 	gs_enter_context(obs->video.graphics);
 	gs_texrender_destroy(source->async_convert_texrender);
 	gs_texture_destroy(source->async_texture);
+	gs_texrender_destroy(source->render_cache);
 	gs_leave_context();
 
 	for (i = 0; i < MAX_AV_PLANES; i++)
@@ -374,6 +401,7 @@ static void obs_source_deferred_update(obs_source_t *source)
 				source->context.settings);
 
 	source->defer_update = false;
+	source->render_cache_dirty = true;
 }
 
 void obs_source_update(obs_source_t *source, obs_data_t *settings)
@@ -391,6 +419,12 @@ void obs_source_update(obs_source_t *source, obs_data_t *settings)
 	}
 }
 
+void obs_source_invalidate_render(obs_source_t *source)
+{
+	if (source)
+		source->render_cache_dirty = true;
+}
+
 void obs_source_update_properties(obs_source_t *source)
 {
 	calldata_t calldata;
@@ -1128,10 +1162,15 @@ static void obs_source_render_async_video(obs_source_t *source)
 
 		source->async_rendered = true;
 		if (frame) {
+			uint64_t start = os_gettime_ns();
+
 			if (!set_async_texture_size(source, frame))
 				return;
 			if (!update_async_texture(source, frame))
 				return;
+
+			timing_stat_add(&source->async_video_timing, start,
+					os_gettime_ns());
 		}
 
 		obs_source_release_frame(source, frame);
@@ -1166,16 +1205,90 @@ static inline void obs_source_default_render(obs_source_t *source,
 	gs_technique_end(tech);
 }
 
+static inline void render_cache_tex(gs_texture_t *tex)
+{
+	gs_effect_t    *effect = obs->video.default_effect;
+	gs_technique_t *tech   = gs_effect_get_technique(effect, "Draw");
+	gs_eparam_t    *image  = gs_effect_get_param_by_name(effect, "image");
+	size_t         passes, i;
+
+	gs_effect_set_texture(image, tex);
+
+	passes = gs_technique_begin(tech);
+	for (i = 0; i < passes; i++) {
+		gs_technique_begin_pass(tech, i);
+		gs_draw_sprite(tex, 0, 0, 0);
+		gs_technique_end_pass(tech);
+	}
+	gs_technique_end(tech);
+}
+
+static void obs_source_cached_render(obs_source_t *source, bool color_matrix)
+{
+	uint32_t cx = obs_source_get_width(source);
+	uint32_t cy = obs_source_get_height(source);
+
+	if (!cx || !cy)
+		return;
+
+	if (!source->render_cache) {
+		source->render_cache = gs_texrender_create(GS_RGBA,
+				GS_ZS_NONE);
+		source->render_cache_dirty = true;
+	}
+
+	if (cx != source->render_cache_cx || cy != source->render_cache_cy) {
+		source->render_cache_cx    = cx;
+		source->render_cache_cy    = cy;
+		source->render_cache_dirty = true;
+	}
+
+	if (source->render_cache_dirty) {
+		gs_texrender_reset(source->render_cache);
+		source->render_cache_dirty = false;
+	}
+
+	gs_blend_state_push();
+
+	/* only succeeds once per reset, so this is skipped until the cache
+	 * is invalidated again.  alpha is accumulated rather than multiplied
+	 * by itself again, also when the source resets the blend state */
+	if (gs_texrender_begin(source->render_cache, cx, cy)) {
+		struct vec4 clear_color;
+
+		vec4_zero(&clear_color);
+		gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
+		gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+		gs_enable_alpha_accumulation(true);
+		gs_reset_blend_state();
+		obs_source_default_render(source, color_matrix);
+		gs_enable_alpha_accumulation(false);
+		gs_texrender_end(source->render_cache);
+	}
+
+	/* the source's own blending is already applied to the cache, so its
+	 * color is premultiplied and must not be multiplied by alpha again */
+	gs_enable_blending(true);
+	gs_blend_function(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+	render_cache_tex(gs_texrender_get_texture(source->render_cache));
+
+	gs_blend_state_pop();
+}
+
 static inline void obs_source_main_render(obs_source_t *source)
 {
 	uint32_t flags      = source->info.output_flags;
 	bool color_matrix   = (flags & OBS_SOURCE_COLOR_MATRIX) != 0;
 	bool custom_draw    = (flags & OBS_SOURCE_CUSTOM_DRAW) != 0;
+	bool cacheable      = (flags & OBS_SOURCE_CACHEABLE) != 0;
 	bool default_effect = !source->filter_parent &&
 	                      source->filters.num == 0 &&
 	                      !custom_draw;
 
-	if (default_effect)
+	if (default_effect && cacheable)
+		obs_source_cached_render(source, color_matrix);
+	else if (default_effect)
 		obs_source_default_render(source, color_matrix);
 	else if (source->context.data)
 		source->info.video_render(source->context.data,
@@ -1184,8 +1297,12 @@ static inline void obs_source_main_render(obs_source_t *source)
 
 void obs_source_video_render(obs_source_t *source)
 {
+	uint64_t start;
+
 	if (!source_valid(source)) return;
 
+	start = os_gettime_ns();
+
 	if (source->filters.num && !source->rendering_filter)
 		obs_source_render_filters(source);
 
@@ -1197,6 +1314,8 @@ void obs_source_video_render(obs_source_t *source)
 
 	else
 		obs_source_render_async_video(source);
+
+	timing_stat_add(&source->render_timing, start, os_gettime_ns());
 }
 
 uint32_t obs_source_get_width(const obs_source_t *source)
@@ -1336,8 +1455,12 @@ static inline struct obs_source_frame *filter_async_video(obs_source_t *source,
 		struct obs_source *filter = source->filters.array[i-1];
 
 		if (filter->context.data && filter->info.filter_video) {
+			uint64_t start = os_gettime_ns();
+
 			in = filter->info.filter_video(filter->context.data,
 					in);
+			timing_stat_add(&filter->async_video_timing, start,
+					os_gettime_ns());
 			if (!in)
 				return NULL;
 		}
@@ -1416,12 +1539,51 @@ static inline struct obs_source_frame *cache_video(
 	return new_frame;
 }
 
-static bool ready_async_frame(obs_source_t *source, uint64_t sys_time);
+static bool ready_async_frame(obs_source_t *source);
+
+/* if the source hasn't been rendered in this long, nothing is consuming its
+ * frames, so only the newest one is kept */
+#define ASYNC_IDLE_TIME 100000000ULL
+
+static inline void drop_async_frames(obs_source_t *source, size_t count)
+{
+	if (!count)
+		return;
+
+	for (size_t i = 0; i < count; i++)
+		obs_source_frame_destroy(source->video_frames.array[i]);
+
+	da_erase_range(source->video_frames, 0, count);
+	source->async_frames_dropped += (uint32_t)count;
+}
 
 static inline void cycle_frames(struct obs_source *source)
 {
-	if (source->video_frames.num && !source->activate_refs)
-		ready_async_frame(source, os_gettime_ns());
+	if (!source->video_frames.num || source->activate_refs)
+		return;
+
+	if (os_gettime_ns() - source->last_sys_timestamp > ASYNC_IDLE_TIME) {
+		drop_async_frames(source, source->video_frames.num - 1);
+		source->last_frame_ts = 0;
+	} else {
+		ready_async_frame(source);
+	}
+}
+
+static inline void update_async_interval(obs_source_t *source, uint64_t ts)
+{
+	uint64_t last = source->async_last_input_ts;
+
+	source->async_last_input_ts = ts;
+
+	if (!last || ts <= last || ts - last > MAX_TS_VAR)
+		return;
+
+	if (!source->async_frame_interval)
+		source->async_frame_interval = ts - last;
+	else
+		source->async_frame_interval =
+			(source->async_frame_interval * 7 + (ts - last)) / 8;
 }
 
 void obs_source_output_video(obs_source_t *source,
@@ -1439,6 +1601,7 @@ void obs_source_output_video(obs_source_t *source,
 	if (output) {
 		pthread_mutex_lock(&source->video_mutex);
 		cycle_frames(source);
+		update_async_interval(source, output->timestamp);
 		da_push_back(source->video_frames, &output);
 		pthread_mutex_unlock(&source->video_mutex);
 	}
@@ -1452,8 +1615,12 @@ static inline struct obs_audio_data *filter_async_audio(obs_source_t *source,
 		struct obs_source *filter = source->filters.array[i-1];
 
 		if (filter->context.data && filter->info.filter_audio) {
+			uint64_t start = os_gettime_ns();
+
 			in = filter->info.filter_audio(filter->context.data,
 					in);
+			timing_stat_add(&filter->audio_timing, start,
+					os_gettime_ns());
 			if (!in)
 				return NULL;
 		}
@@ -1555,10 +1722,12 @@ void obs_source_output_audio(obs_source_t *source,
 {
 	uint32_t flags;
 	struct obs_audio_data *output;
+	uint64_t start;
 
 	if (!source || !audio)
 		return;
 
+	start = os_gettime_ns();
 	flags = source->info.output_flags;
 	process_audio(source, audio);
 
@@ -1587,6 +1756,8 @@ void obs_source_output_audio(obs_source_t *source,
 	}
 
 	pthread_mutex_unlock(&source->filter_mutex);
+
+	timing_stat_add(&source->audio_timing, start, os_gettime_ns());
 }
 
 static inline bool frame_out_of_bounds(const obs_source_t *source, uint64_t ts)
@@ -1597,106 +1768,126 @@ static inline bool frame_out_of_bounds(const obs_source_t *source, uint64_t ts)
 		return ((ts - source->last_frame_ts) > MAX_TS_VAR);
 }
 
-/* #define DEBUG_ASYNC_FRAMES 1 */
+/*
+ * Async frames are presented against a per-source clock in the frame
+ * timestamp domain (last_frame_ts).  Each render the clock advances by the
+ * elapsed system time, plus a correction from a PI loop that keeps it about
+ * one frame interval behind the newest buffered frame.  That absorbs drift
+ * between the capture clock and the system clock without jumping, and the
+ * frame with the timestamp nearest to the clock is the one shown.
+ *
+ * Gains are expressed as divisors: kp = 1/64, ki = 1/4096 per render.
+ */
+#define ASYNC_PLL_KP 64
+#define ASYNC_PLL_KI 4096
+#define ASYNC_PLL_MAX_INTEGRAL ((int64_t)MAX_TS_VAR)
 
-static bool ready_async_frame(obs_source_t *source, uint64_t sys_time)
+static inline int64_t clamp_i64(int64_t val, int64_t min_val, int64_t max_val)
 {
-	struct obs_source_frame *next_frame = source->video_frames.array[0];
-	struct obs_source_frame *frame      = NULL;
-	uint64_t sys_offset = sys_time - source->last_sys_timestamp;
-	uint64_t frame_time = next_frame->timestamp;
-	uint64_t frame_offset = 0;
+	return val < min_val ? min_val : (val > max_val ? max_val : val);
+}
 
-	if ((source->flags & OBS_SOURCE_UNBUFFERED) != 0) {
-		while (source->video_frames.num > 1) {
-			da_erase(source->video_frames, 0);
-			obs_source_frame_destroy(next_frame);
-			next_frame = source->video_frames.array[0];
-		}
+static inline void reset_async_clock(obs_source_t *source, uint64_t ts)
+{
+	source->last_frame_ts      = ts;
+	source->async_pll_integral = 0;
+}
 
-		return true;
-	}
+static void advance_async_clock(obs_source_t *source, uint64_t sys_time)
+{
+	int64_t elapsed = (int64_t)(sys_time - source->last_sys_timestamp);
+	int64_t phase_err;
+	int64_t correction = 0;
 
-#if DEBUG_ASYNC_FRAMES
-	blog(LOG_DEBUG, "source->last_frame_ts: %llu, frame_time: %llu, "
-			"sys_offset: %llu, frame_offset: %llu, "
-			"number of frames: %lu",
-			source->last_frame_ts, frame_time, sys_offset,
-			frame_time - source->last_frame_ts,
-			(unsigned long)source->video_frames.num);
-#endif
+	if (source->video_frames.num) {
+		struct obs_source_frame *newest =
+			source->video_frames.array[source->video_frames.num-1];
 
-	/* account for timestamp invalidation */
-	if (frame_out_of_bounds(source, frame_time)) {
-#if DEBUG_ASYNC_FRAMES
-		blog(LOG_DEBUG, "timing jump");
-#endif
-		source->last_frame_ts = next_frame->timestamp;
-		return true;
-	} else {
-		frame_offset = frame_time - source->last_frame_ts;
-		source->last_frame_ts += sys_offset;
-	}
+		phase_err = (int64_t)(newest->timestamp - source->last_frame_ts);
+		phase_err -= (int64_t)source->async_frame_interval;
 
-	while (source->last_frame_ts > next_frame->timestamp) {
+		source->async_pll_integral = clamp_i64(
+				source->async_pll_integral + phase_err,
+				-ASYNC_PLL_MAX_INTEGRAL,
+				ASYNC_PLL_MAX_INTEGRAL);
 
-		/* this tries to reduce the needless frame duplication, also
-		 * helps smooth out async rendering to frame boundaries.  In
-		 * other words, tries to keep the framerate as smooth as
-		 * possible */
-		if ((source->last_frame_ts - next_frame->timestamp) < 1000000)
-			break;
+		correction = phase_err / ASYNC_PLL_KP +
+			source->async_pll_integral / ASYNC_PLL_KI;
 
-		if (frame)
-			da_erase(source->video_frames, 0);
+		/* never run the clock backwards or at more than 1.5x */
+		correction = clamp_i64(correction, -elapsed / 2, elapsed / 2);
+	}
 
-#if DEBUG_ASYNC_FRAMES
-		blog(LOG_DEBUG, "new frame, "
-				"source->last_frame_ts: %llu, "
-				"next_frame->timestamp: %llu",
-				source->last_frame_ts,
-				next_frame->timestamp);
-#endif
+	source->last_frame_ts += (uint64_t)(elapsed + correction);
+}
 
-		obs_source_frame_destroy(frame);
+/* returns true if video_frames.array[0] is the frame to be shown next,
+ * releasing any frames before it */
+static bool ready_async_frame(obs_source_t *source)
+{
+	struct obs_source_frame **frames = source->video_frames.array;
+	uint64_t clock     = source->last_frame_ts;
+	size_t   best      = 0;
+	uint64_t best_diff;
 
-		if (source->video_frames.num == 1)
-			return true;
+	if ((source->flags & OBS_SOURCE_UNBUFFERED) != 0) {
+		drop_async_frames(source, source->video_frames.num - 1);
+		return true;
+	}
 
-		frame = next_frame;
-		next_frame = source->video_frames.array[1];
+	/* account for timestamp invalidation */
+	if (frame_out_of_bounds(source, frames[0]->timestamp)) {
+		reset_async_clock(source, frames[0]->timestamp);
+		return true;
+	}
 
-		/* more timestamp checking and compensating */
-		if ((next_frame->timestamp - frame_time) > MAX_TS_VAR) {
-#if DEBUG_ASYNC_FRAMES
-			blog(LOG_DEBUG, "timing jump");
-#endif
-			source->last_frame_ts =
-				next_frame->timestamp - frame_offset;
-		}
+	/* timestamps increase, so the distance to the clock only shrinks up
+	 * to the nearest frame.  frames past a timestamp jump are left until
+	 * they reach the front of the queue */
+	best_diff = uint64_diff(frames[0]->timestamp, clock);
+	for (size_t i = 1; i < source->video_frames.num; i++) {
+		uint64_t diff;
 
-		frame_time   = next_frame->timestamp;
-		frame_offset = frame_time - source->last_frame_ts;
+		if (uint64_diff(frames[i]->timestamp, frames[i-1]->timestamp)
+				> MAX_TS_VAR)
+			break;
+
+		diff = uint64_diff(frames[i]->timestamp, clock);
+		if (diff > best_diff)
+			break;
+
+		best      = i;
+		best_diff = diff;
 	}
 
-#if DEBUG_ASYNC_FRAMES
-	if (!frame)
-		blog(LOG_DEBUG, "no frame!");
-#endif
+	drop_async_frames(source, best);
 
-	return frame != NULL;
+	/* a frame that's due in the future is only worth showing if it's
+	 * closer to the clock than the one that's already on screen */
+	frames = source->video_frames.array;
+	if (frames[0]->timestamp > clock && source->async_shown_ts &&
+	    uint64_diff(source->async_shown_ts, clock) <= best_diff)
+		return false;
+
+	return true;
 }
 
 static inline struct obs_source_frame *get_closest_frame(obs_source_t *source,
 		uint64_t sys_time)
 {
-	if (ready_async_frame(source, sys_time)) {
-		struct obs_source_frame *frame = source->video_frames.array[0];
-		da_erase(source->video_frames, 0);
-		return frame;
-	}
+	struct obs_source_frame *frame;
 
-	return NULL;
+	advance_async_clock(source, sys_time);
+
+	if (!ready_async_frame(source))
+		return NULL;
+
+	frame = source->video_frames.array[0];
+	da_erase(source->video_frames, 0);
+
+	source->async_pts_error += uint64_diff(frame->timestamp,
+			source->last_frame_ts);
+	return frame;
 }
 
 /*
@@ -1717,14 +1908,17 @@ struct obs_source_frame *obs_source_get_frame(obs_source_t *source)
 
 	sys_time = os_gettime_ns();
 
-	if (!source->video_frames.num)
+	if (!source->video_frames.num) {
+		if (source->last_frame_ts)
+			advance_async_clock(source, sys_time);
 		goto unlock;
+	}
 
 	if (!source->last_frame_ts) {
 		frame = source->video_frames.array[0];
 		da_erase(source->video_frames, 0);
 
-		source->last_frame_ts = frame->timestamp;
+		reset_async_clock(source, frame->timestamp);
 	} else {
 		frame = get_closest_frame(source, sys_time);
 	}
@@ -1738,6 +1932,13 @@ struct obs_source_frame *obs_source_get_frame(obs_source_t *source)
 unlock:
 	source->last_sys_timestamp = sys_time;
 
+	if (frame) {
+		source->async_shown_ts = frame->timestamp;
+		source->async_frames_shown++;
+	} else if (source->last_frame_ts) {
+		source->async_frames_repeated++;
+	}
+
 	pthread_mutex_unlock(&source->video_mutex);
 
 	if (frame)
@@ -2115,3 +2316,42 @@ uint32_t obs_source_get_flags(const obs_source_t *source)
 {
 	return source ? source->flags : 0;
 }
+
+uint64_t obs_source_get_tick_time(const obs_source_t *source)
+{
+	return source ? source->tick_time : 0;
+}
+
+bool obs_source_get_timing(const obs_source_t *source,
+		struct obs_source_timing *timing)
+{
+	uint64_t now = os_gettime_ns();
+
+	if (!source || !timing)
+		return false;
+
+	timing_stat_get(&source->tick_timing, now,
+			&timing->tick_avg, &timing->tick_max);
+	timing_stat_get(&source->render_timing, now,
+			&timing->render_avg, &timing->render_max);
+	timing_stat_get(&source->async_video_timing, now,
+			&timing->async_video_avg, &timing->async_video_max);
+	timing_stat_get(&source->audio_timing, now,
+			&timing->audio_avg, &timing->audio_max);
+	return true;
+}
+
+bool obs_source_get_async_stats(const obs_source_t *source,
+		struct obs_source_async_stats *stats)
+{
+	if (!source || !stats)
+		return false;
+
+	stats->frames_shown    = source->async_frames_shown;
+	stats->frames_repeated = source->async_frames_repeated;
+	stats->frames_dropped  = source->async_frames_dropped;
+	stats->avg_pts_error   = source->async_frames_shown ?
+		source->async_pts_error / source->async_frames_shown : 0;
+	stats->frame_interval  = source->async_frame_interval;
+	return true;
+}
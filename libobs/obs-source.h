@@ -103,6 +103,30 @@ enum obs_source_type {
  */
 #define OBS_SOURCE_INTERACTION (1<<5)
 
+/**
+ * Source render output is cacheable.
+ *
+ * When this is used, libobs renders the source to a texture and redraws that
+ * texture each frame instead of calling video_render, until the source is
+ * updated, changes size, or obs_source_invalidate_render is called.  Only
+ * use this for sources whose output does not change on its own.  The cached
+ * texture is composited the same way as the render target of a filter.
+ */
+#define OBS_SOURCE_CACHEABLE   (1<<6)
+
+/**
+ * Source video_tick can run on a tick worker thread.
+ *
+ * When this is used, video_tick (and any deferred update) may be called from
+ * a worker thread in parallel with the ticks of other sources, so that slow
+ * ticks don't hold up the rest of the frame.  The tick must call
+ * obs_enter_graphics for any graphics work.  Sources that are being ticked
+ * are referenced by the video thread for the duration of the tick, so if a
+ * tick releases the last outside reference to one of them, it is destroyed
+ * on the video thread once the tick has finished.
+ */
+#define OBS_SOURCE_THREADED_TICK (1<<7)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t *parent,
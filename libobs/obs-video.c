@@ -20,12 +20,286 @@
 #include "graphics/vec4.h"
 #include "media-io/format-conversion.h"
 
+#define MAX_TICK_THREADS 8
+
+static inline void tick_source(struct obs_source *source, float seconds)
+{
+	uint64_t start = os_gettime_ns();
+	uint64_t end;
+
+	obs_source_video_tick(source, seconds);
+
+	end = os_gettime_ns();
+	source->tick_time = end - start;
+	timing_stat_add(&source->tick_timing, start, end);
+}
+
+static void run_tick_jobs(struct obs_core_video *video)
+{
+	long idx;
+
+	while ((idx = os_atomic_inc_long(&video->tick_job_idx) - 1) <
+			(long)video->tick_jobs.num)
+		tick_source(video->tick_jobs.array[idx], video->tick_seconds);
+}
+
+static void *tick_thread(void *param)
+{
+	struct obs_core_video *video = param;
+
+	while (os_sem_wait(video->tick_start_sem) == 0) {
+		if (video->tick_threads_exit)
+			break;
+
+		run_tick_jobs(video);
+		os_sem_post(video->tick_done_sem);
+	}
+
+	return NULL;
+}
+
+bool obs_init_tick_threads(void)
+{
+	struct obs_core_video *video = &obs->video;
+	int cores = os_get_logical_cores();
+	size_t count;
+
+	/* leave a core for the video thread itself */
+	count = cores > 1 ? (size_t)(cores - 1) : 0;
+	if (count > MAX_TICK_THREADS)
+		count = MAX_TICK_THREADS;
+	if (!count)
+		return true;
+
+	if (os_sem_init(&video->tick_start_sem, 0) != 0)
+		return false;
+	if (os_sem_init(&video->tick_done_sem, 0) != 0) {
+		os_sem_destroy(video->tick_start_sem);
+		video->tick_start_sem = NULL;
+		return false;
+	}
+
+	video->tick_threads_exit = false;
+	video->tick_threads = bzalloc(sizeof(pthread_t) * count);
+
+	for (size_t i = 0; i < count; i++) {
+		if (pthread_create(&video->tick_threads[i], NULL,
+					tick_thread, video) != 0) {
+			blog(LOG_ERROR, "Failed to create tick thread %d",
+					(int)i);
+			break;
+		}
+
+		video->num_tick_threads++;
+	}
+
+	return true;
+}
+
+void obs_free_tick_threads(void)
+{
+	struct obs_core_video *video = &obs->video;
+	void *thread_retval;
+
+	video->tick_threads_exit = true;
+
+	for (size_t i = 0; i < video->num_tick_threads; i++)
+		os_sem_post(video->tick_start_sem);
+	for (size_t i = 0; i < video->num_tick_threads; i++)
+		pthread_join(video->tick_threads[i], &thread_retval);
+
+	os_sem_destroy(video->tick_start_sem);
+	os_sem_destroy(video->tick_done_sem);
+	bfree(video->tick_threads);
+	da_free(video->tick_jobs);
+	da_free(video->tick_snapshot);
+
+	video->tick_start_sem   = NULL;
+	video->tick_done_sem    = NULL;
+	video->tick_threads     = NULL;
+	video->num_tick_threads = 0;
+}
+
+static struct obs_source *pop_destroy_list(struct obs_core_video *video)
+{
+	struct obs_source *source = NULL;
+
+	pthread_mutex_lock(&video->destroy_mutex);
+	if (video->destroy_list.num) {
+		source = video->destroy_list.array[0];
+		da_erase(video->destroy_list, 0);
+	}
+	pthread_mutex_unlock(&video->destroy_mutex);
+
+	return source;
+}
+
+static void *destroy_thread(void *param)
+{
+	struct obs_core_video *video = param;
+
+	while (os_sem_wait(video->destroy_sem) == 0) {
+		struct obs_source *source = pop_destroy_list(video);
+
+		if (source)
+			obs_source_destroy(source);
+		else if (video->destroy_thread_exit)
+			break;
+	}
+
+	return NULL;
+}
+
+bool obs_init_destroy_thread(void)
+{
+	struct obs_core_video *video = &obs->video;
+
+	pthread_mutex_init_value(&video->destroy_mutex);
+
+	if (pthread_mutex_init(&video->destroy_mutex, NULL) != 0)
+		return false;
+	if (os_sem_init(&video->destroy_sem, 0) != 0)
+		return false;
+
+	video->destroy_thread_exit = false;
+
+	if (pthread_create(&video->destroy_thread, NULL, destroy_thread,
+				video) != 0)
+		return false;
+
+	video->destroy_thread_active = true;
+	return true;
+}
+
+/* sources already handed to the thread are destroyed before it exits */
+void obs_free_destroy_thread(void)
+{
+	struct obs_core_video *video = &obs->video;
+	void *thread_retval;
+
+	if (video->destroy_thread_active) {
+		video->destroy_thread_exit = true;
+		os_sem_post(video->destroy_sem);
+		pthread_join(video->destroy_thread, &thread_retval);
+		video->destroy_thread_active = false;
+	}
+
+	os_sem_destroy(video->destroy_sem);
+	pthread_mutex_destroy(&video->destroy_mutex);
+	da_free(video->destroy_list);
+
+	video->destroy_sem = NULL;
+}
+
+static inline bool threaded_tick(const struct obs_source *source)
+{
+	return obs->video.num_tick_threads &&
+		(source->info.output_flags & OBS_SOURCE_THREADED_TICK) != 0;
+}
+
+/* log sources that took at least this long for anything in a window */
+#define TIMING_LOG_INTERVAL  60000000000ULL
+#define TIMING_LOG_THRESHOLD 1000000ULL
+
+#define NS_TO_MS(val) ((double)(val) / 1000000.0)
+
+static void log_source_timing(struct obs_core_video *video)
+{
+	bool header = false;
+
+	for (size_t i = 0; i < video->tick_snapshot.num; i++) {
+		struct obs_source *source = video->tick_snapshot.array[i];
+		struct obs_source_timing t;
+
+		if (!obs_source_get_timing(source, &t))
+			continue;
+		if (t.tick_max        < TIMING_LOG_THRESHOLD &&
+		    t.render_max      < TIMING_LOG_THRESHOLD &&
+		    t.async_video_max < TIMING_LOG_THRESHOLD &&
+		    t.audio_max       < TIMING_LOG_THRESHOLD)
+			continue;
+
+		if (!header) {
+			blog(LOG_INFO, "Source timings (avg/max ms):");
+			header = true;
+		}
+
+		blog(LOG_INFO, "\t'%s': tick %.2f/%.2f, render %.2f/%.2f, "
+		               "async video %.2f/%.2f, audio %.2f/%.2f",
+				source->context.name,
+				NS_TO_MS(t.tick_avg),   NS_TO_MS(t.tick_max),
+				NS_TO_MS(t.render_avg), NS_TO_MS(t.render_max),
+				NS_TO_MS(t.async_video_avg),
+				NS_TO_MS(t.async_video_max),
+				NS_TO_MS(t.audio_avg),  NS_TO_MS(t.audio_max));
+	}
+}
+
+/* takes a reference only if the source isn't already being destroyed */
+static inline bool tick_addref(struct obs_source *source)
+{
+	long refs;
+
+	while ((refs = source->refs) > 0) {
+		if (os_atomic_compare_swap_long(&source->refs, refs, refs + 1))
+			return true;
+	}
+
+	return false;
+}
+
+/* the tick list is copied with a reference to each source so tick_mutex is
+ * only held for the copy, not for the ticks themselves.  sources released
+ * during the tick stay alive until the references are dropped after the
+ * tick */
+static void snapshot_tick_list(struct obs_core_data *data,
+		struct obs_core_video *video)
+{
+	da_resize(video->tick_snapshot, 0);
+
+	pthread_mutex_lock(&data->tick_mutex);
+
+	for (size_t i = 0; i < data->tick_list.num; i++) {
+		struct obs_source *source = data->tick_list.array[i];
+
+		if (tick_addref(source))
+			da_push_back(video->tick_snapshot, &source);
+	}
+
+	pthread_mutex_unlock(&data->tick_mutex);
+}
+
+/* a source released elsewhere during the tick has its last reference
+ * dropped here, it's handed to the destroy thread rather than destroyed on
+ * the video thread */
+static void release_tick_snapshot(struct obs_core_video *video)
+{
+	for (size_t i = 0; i < video->tick_snapshot.num; i++) {
+		struct obs_source *source = video->tick_snapshot.array[i];
+
+		if (os_atomic_dec_long(&source->refs) != 0)
+			continue;
+
+		if (video->destroy_thread_active) {
+			pthread_mutex_lock(&video->destroy_mutex);
+			da_push_back(video->destroy_list, &source);
+			pthread_mutex_unlock(&video->destroy_mutex);
+			os_sem_post(video->destroy_sem);
+		} else {
+			obs_source_destroy(source);
+		}
+	}
+
+	da_resize(video->tick_snapshot, 0);
+}
+
 static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 {
-	struct obs_core_data *data = &obs->data;
-	struct obs_source    *source;
-	uint64_t             delta_time;
-	float                seconds;
+	struct obs_core_data  *data  = &obs->data;
+	struct obs_core_video *video = &obs->video;
+	uint64_t              delta_time;
+	float                 seconds;
+	size_t                workers = 0;
 
 	if (!last_time)
 		last_time = cur_time -
@@ -34,17 +308,51 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 	delta_time = cur_time - last_time;
 	seconds = (float)((double)delta_time / 1000000000.0);
 
-	pthread_mutex_lock(&data->sources_mutex);
+	snapshot_tick_list(data, video);
+
+	/* hand off thread-safe ticks to the workers first so they run while
+	 * the rest are ticked here */
+	da_resize(video->tick_jobs, 0);
+	for (size_t i = 0; i < video->tick_snapshot.num; i++) {
+		struct obs_source *source = video->tick_snapshot.array[i];
+
+		if (threaded_tick(source))
+			da_push_back(video->tick_jobs, &source);
+	}
+
+	if (video->tick_jobs.num) {
+		video->tick_seconds = seconds;
+		video->tick_job_idx = 0;
 
-	source = data->first_source;
-	while (source) {
-		if (source->refs)
-			obs_source_video_tick(source, seconds);
-		source = (struct obs_source*)source->context.next;
+		workers = video->tick_jobs.num < video->num_tick_threads ?
+			video->tick_jobs.num : video->num_tick_threads;
+		for (size_t i = 0; i < workers; i++)
+			os_sem_post(video->tick_start_sem);
 	}
 
-	pthread_mutex_unlock(&data->sources_mutex);
+	for (size_t i = 0; i < video->tick_snapshot.num; i++) {
+		struct obs_source *source = video->tick_snapshot.array[i];
+
+		if (!threaded_tick(source))
+			tick_source(source, seconds);
+	}
+
+	/* help out with any remaining jobs, then wait for the workers */
+	if (workers) {
+		run_tick_jobs(video);
+
+		for (size_t i = 0; i < workers; i++)
+			os_sem_wait(video->tick_done_sem);
+	}
+
+	if (!video->last_timing_log) {
+		video->last_timing_log = cur_time;
+	} else if (cur_time - video->last_timing_log >= TIMING_LOG_INTERVAL) {
+		log_source_timing(video);
+		video->last_timing_log = cur_time;
+	}
 
+	release_tick_snapshot(video);
 	return cur_time;
 }
 
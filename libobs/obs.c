@@ -296,6 +296,11 @@ static int obs_init_video(struct obs_video_info *ovi)
 
 	gs_leave_context();
 
+	if (!obs_init_tick_threads())
+		return OBS_VIDEO_FAIL;
+	if (!obs_init_destroy_thread())
+		return OBS_VIDEO_FAIL;
+
 	errorcode = pthread_create(&video->video_thread, NULL,
 			obs_video_thread, obs);
 	if (errorcode != 0)
@@ -318,6 +323,8 @@ static void stop_video(void)
 		}
 	}
 
+	obs_free_tick_threads();
+	obs_free_destroy_thread();
 }
 
 static void obs_free_video(void)
@@ -419,6 +426,7 @@ static bool obs_init_data(void)
 	assert(data != NULL);
 
 	pthread_mutex_init_value(&obs->data.displays_mutex);
+	pthread_mutex_init_value(&obs->data.tick_mutex);
 
 	if (pthread_mutexattr_init(&attr) != 0)
 		return false;
@@ -436,6 +444,8 @@ static bool obs_init_data(void)
 		goto fail;
 	if (pthread_mutex_init(&data->services_mutex, &attr) != 0)
 		goto fail;
+	if (pthread_mutex_init(&data->tick_mutex, &attr) != 0)
+		goto fail;
 	if (!obs_view_init(&data->main_view))
 		goto fail;
 
@@ -488,6 +498,9 @@ static void obs_free_data(void)
 	pthread_mutex_destroy(&data->outputs_mutex);
 	pthread_mutex_destroy(&data->encoders_mutex);
 	pthread_mutex_destroy(&data->services_mutex);
+	pthread_mutex_destroy(&data->tick_mutex);
+
+	da_free(data->tick_list);
 }
 
 static const char *obs_signals[] = {
@@ -205,6 +205,68 @@ struct obs_source_frame {
 	bool                flip;
 };
 
+/**
+ * Per-source timing statistics, in nanoseconds.  Values are the average and
+ * maximum over the last completed one second window, or 0 if the source
+ * hasn't done that kind of work in the last two seconds.
+ *
+ * Render times are CPU-side and include child sources and filters.  For
+ * filters, async_video is the time spent in filter_video and audio the time
+ * spent in filter_audio.
+ */
+struct obs_source_timing {
+	uint64_t            tick_avg;
+	uint64_t            tick_max;
+	uint64_t            render_avg;
+	uint64_t            render_max;
+	uint64_t            async_video_avg;
+	uint64_t            async_video_max;
+	uint64_t            audio_avg;
+	uint64_t            audio_max;
+};
+
+/**
+ * Encoder statistics since the encoder last started.  Encode times and
+ * latencies are in nanoseconds, and are the 50th and 99th percentiles of the
+ * last 512 frames/packets.
+ *
+ * Latency is the time from when a frame was captured until its packet came
+ * out of the encoder, delay_frames is how many frames were inside the encoder
+ * when the last packet came out.  bytes_per_sec is measured over the last 512
+ * packets, keyframe_interval is the average time between keyframes in
+ * seconds.
+ */
+struct obs_encoder_stats {
+	uint64_t            frames;
+	uint64_t            packets;
+	uint64_t            bytes;
+	uint64_t            keyframes;
+	uint64_t            encode_p50;
+	uint64_t            encode_p99;
+	uint64_t            latency_p50;
+	uint64_t            latency_p99;
+	int                 delay_frames;
+	int                 max_delay_frames;
+	uint64_t            bytes_per_sec;
+	double              keyframe_interval;
+};
+
+/**
+ * Presentation statistics of an async video source since it was created.
+ *
+ * Repeated frames are renders where no new frame was due, dropped frames are
+ * frames that were never shown, and avg_pts_error is the average distance in
+ * nanoseconds between the timestamps of shown frames and the presentation
+ * clock of the source.
+ */
+struct obs_source_async_stats {
+	uint32_t            frames_shown;
+	uint32_t            frames_repeated;
+	uint32_t            frames_dropped;
+	uint64_t            avg_pts_error;
+	uint64_t            frame_interval;
+};
+
 /* ------------------------------------------------------------------------- */
 /* OBS context */
 
@@ -739,6 +801,17 @@ EXPORT void obs_source_set_flags(obs_source_t *source, uint32_t flags);
 /** Gets source flags. */
 EXPORT uint32_t obs_source_get_flags(const obs_source_t *source);
 
+/** Gets the duration of the last video tick of the source in nanoseconds */
+EXPORT uint64_t obs_source_get_tick_time(const obs_source_t *source);
+
+/** Gets the presentation statistics of an async video source */
+EXPORT bool obs_source_get_async_stats(const obs_source_t *source,
+		struct obs_source_async_stats *stats);
+
+/** Gets the rolling tick/render/async video/audio timings of the source */
+EXPORT bool obs_source_get_timing(const obs_source_t *source,
+		struct obs_source_timing *timing);
+
 /* ------------------------------------------------------------------------- */
 /* Functions used by sources */
 
@@ -750,6 +823,12 @@ EXPORT void obs_source_output_video(obs_source_t *source,
 EXPORT void obs_source_output_audio(obs_source_t *source,
 		const struct obs_source_audio *audio);
 
+/**
+ * Marks the cached render of a source (OBS_SOURCE_CACHEABLE) as out of date so
+ * it is re-rendered on the next frame
+ */
+EXPORT void obs_source_invalidate_render(obs_source_t *source);
+
 /** Signal an update to any currently used properties via 'update_properties' */
 EXPORT void obs_source_update_properties(obs_source_t *source);
 
@@ -997,6 +1076,25 @@ EXPORT obs_encoder_t *obs_output_get_video_encoder(const obs_output_t *output);
 /** Returns the current audio encoder associated with this output */
 EXPORT obs_encoder_t *obs_output_get_audio_encoder(const obs_output_t *output);
 
+/**
+ * Sets the audio encoder of a specific audio track of this output.  Track 0
+ * is the same encoder as obs_output_set_audio_encoder, other tracks are only
+ * available to outputs with the OBS_OUTPUT_MULTI_TRACK flag.  Each track's
+ * encoder can be bound to its own audio context with obs_encoder_set_audio.
+ * An encoder can only be used for one track of an output, and unlike
+ * obs_output_set_audio_encoder, tracks cannot be changed while the output
+ * is active.
+ */
+EXPORT void obs_output_set_audio_track_encoder(obs_output_t *output,
+		obs_encoder_t *encoder, size_t track);
+
+/** Returns the audio encoder of a specific audio track of this output */
+EXPORT obs_encoder_t *obs_output_get_audio_track_encoder(
+		const obs_output_t *output, size_t track);
+
+/** Returns the number of audio tracks that have an encoder set */
+EXPORT size_t obs_output_get_num_audio_tracks(const obs_output_t *output);
+
 /** Sets the current service associated with this output. */
 EXPORT void obs_output_set_service(obs_output_t *output,
 		obs_service_t *service);
@@ -1108,6 +1206,17 @@ EXPORT void obs_encoder_destroy(obs_encoder_t *encoder);
 
 EXPORT const char *obs_encoder_get_name(const obs_encoder_t *encoder);
 
+/** Returns the capability flags of the encoder (OBS_ENCODER_CAP_*) */
+EXPORT uint32_t obs_encoder_get_caps(const obs_encoder_t *encoder);
+
+/**
+ * Returns whether the video encoder outputs AVCC framed packets.  This is
+ * decided when the encoder is initialized, an encoder with
+ * OBS_ENCODER_CAP_AVCC uses AVCC only if all of its outputs set
+ * OBS_OUTPUT_AVCC.
+ */
+EXPORT bool obs_encoder_avcc_enabled(const obs_encoder_t *encoder);
+
 /** Returns the codec of the encoder */
 EXPORT const char *obs_encoder_get_codec(const obs_encoder_t *encoder);
 
@@ -1139,10 +1248,53 @@ EXPORT obs_properties_t *obs_encoder_properties(const obs_encoder_t *encoder);
 
 /**
  * Updates the settings of the encoder context.  Usually used for changing
- * bitrate while active
+ * bitrate, buffer size or rate factor while active.
+ *
+ * If the encoder is active, the new settings are stored immediately but only
+ * handed to the encoder on its own thread before the next frame is encoded.
+ * Settings that cannot change without restarting the encoder (resolution,
+ * preset, profile and the like) only take effect the next time it starts.
  */
 EXPORT void obs_encoder_update(obs_encoder_t *encoder, obs_data_t *settings);
 
+/**
+ * Requests a new target bitrate (in kbps) for an active encoder without
+ * touching its settings.  The change is applied from the encoder thread
+ * before the next frame is encoded.  Passing 0 returns the encoder to the
+ * bitrate in its settings.
+ *
+ * @return  false if the encoder does not support changing its bitrate
+ */
+EXPORT bool obs_encoder_set_bitrate(obs_encoder_t *encoder, uint32_t kbps);
+
+/**
+ * Requests that the next frame a video encoder encodes be a keyframe (IDR),
+ * for example so a newly connected destination doesn't have to wait for the
+ * next regular keyframe.
+ *
+ * @return  false if the encoder does not support keyframe requests
+ */
+EXPORT bool obs_encoder_request_keyframe(obs_encoder_t *encoder);
+
+/**
+ * Returns the bitrate (in kbps) the encoder is currently targeting, which is
+ * either the last bitrate requested with obs_encoder_set_bitrate or the
+ * "bitrate" value of its settings
+ */
+EXPORT uint32_t obs_encoder_get_bitrate(const obs_encoder_t *encoder);
+
+/**
+ * Returns whether any active output other than the given one uses the
+ * encoder, for example to check that changing the encoder's bitrate only
+ * affects that output.
+ */
+EXPORT bool obs_encoder_has_other_active_outputs(const obs_encoder_t *encoder,
+		const obs_output_t *output);
+
+/** Gets the encode time, latency and throughput statistics of the encoder */
+EXPORT bool obs_encoder_get_stats(const obs_encoder_t *encoder,
+		struct obs_encoder_stats *stats);
+
 /** Gets extra data (headers) associated with this context */
 EXPORT bool obs_encoder_get_extra_data(const obs_encoder_t *encoder,
 		uint8_t **extra_data, size_t *size);
@@ -1171,12 +1323,33 @@ EXPORT audio_t *obs_encoder_audio(const obs_encoder_t *encoder);
 /** Returns true if encoder is active, false otherwise */
 EXPORT bool obs_encoder_active(const obs_encoder_t *encoder);
 
-/** Duplicates an encoder packet */
+/**
+ * Duplicates an encoder packet into a plain allocation.  Packets passed to
+ * outputs are reference counted; use obs_encoder_packet_ref instead.
+ */
 EXPORT void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src);
 
+/** Frees a packet created with obs_duplicate_encoder_packet */
 EXPORT void obs_free_encoder_packet(struct encoder_packet *packet);
 
+/**
+ * Adds a reference to the data of an encoder packet.  Packets sent to
+ * outputs by encoders share one buffer (their refs member is set), so
+ * outputs that need to keep a packet past the encoded_packet callback
+ * should take a reference rather than copying it.  A packet that is not
+ * shared, such as a header packet or one created by obs_parse_avc_packet,
+ * is copied in to a new shared buffer instead.
+ */
+EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src);
+
+/**
+ * Releases a reference taken with obs_encoder_packet_ref.  The data of a
+ * packet that is not shared is left alone.
+ */
+EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
+
 
 /* ------------------------------------------------------------------------- */
 /* Stream Services */
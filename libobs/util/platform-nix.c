@@ -117,6 +117,11 @@ void os_cpu_usage_info_destroy(os_cpu_usage_info_t *info)
 
 #endif
 
+int os_get_logical_cores(void)
+{
+	return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+
 bool os_sleepto_ns(uint64_t time_target)
 {
 	uint64_t current = os_gettime_ns();
@@ -143,6 +143,13 @@ void os_cpu_usage_info_destroy(os_cpu_usage_info_t *info)
 		bfree(info);
 }
 
+int os_get_logical_cores(void)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+}
+
 bool os_sleepto_ns(uint64_t time_target)
 {
 	uint64_t t = os_gettime_ns();
@@ -248,3 +248,9 @@ long os_atomic_dec_long(volatile long *val)
 {
 	return __sync_sub_and_fetch(val, 1);
 }
+
+bool os_atomic_compare_swap_long(volatile long *val, long old_val,
+		long new_val)
+{
+	return __sync_bool_compare_and_swap(val, old_val, new_val);
+}
@@ -72,6 +72,8 @@ EXPORT int  os_sem_wait(os_sem_t *sem);
 
 EXPORT long os_atomic_inc_long(volatile long *val);
 EXPORT long os_atomic_dec_long(volatile long *val);
+EXPORT bool os_atomic_compare_swap_long(volatile long *val, long old_val,
+		long new_val);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2015 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+#include <string.h>
+#include <inttypes.h>
+
+#include "base.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bookkeeping for outputs that queue packets for a write thread
+ *
+ *   The queue itself and its locking are up to the output, this only keeps
+ * count of the queued bytes, decides what to drop, and collects writer
+ * statistics.  Once more than WRITE_QUEUE_MAX_BYTES are waiting, video is
+ * dropped until the next keyframe after the queue has drained back below
+ * the limit.
+ */
+
+#define WRITE_QUEUE_MAX_BYTES (128 * 1024 * 1024)
+
+struct write_queue_stats {
+	size_t   queued_bytes;
+	bool     dropping;
+	int      dropped_frames;
+
+	size_t   max_queued_bytes;
+	uint64_t total_write_ns;
+	uint64_t max_write_ns;
+	uint64_t num_writes;
+	uint64_t total_bytes;
+};
+
+static inline void write_queue_reset(struct write_queue_stats *wq)
+{
+	memset(wq, 0, sizeof(struct write_queue_stats));
+}
+
+/**
+ * Accounts for a packet about to be queued.
+ *
+ * @return  false if the packet should be dropped instead
+ */
+static inline bool write_queue_push(struct write_queue_stats *wq,
+		const char *name, size_t size, bool video, bool keyframe)
+{
+	if (video) {
+		if (wq->queued_bytes > WRITE_QUEUE_MAX_BYTES) {
+			if (!wq->dropping)
+				blog(LOG_WARNING, "[%s] Write queue is full, "
+				                  "dropping video until the "
+				                  "writer catches up", name);
+			wq->dropping = true;
+
+		} else if (wq->dropping && keyframe) {
+			wq->dropping = false;
+		}
+
+		if (wq->dropping) {
+			wq->dropped_frames++;
+			return false;
+		}
+	}
+
+	wq->queued_bytes += size;
+	if (wq->queued_bytes > wq->max_queued_bytes)
+		wq->max_queued_bytes = wq->queued_bytes;
+
+	return true;
+}
+
+/** Accounts for a packet taken off the queue */
+static inline void write_queue_pop(struct write_queue_stats *wq, size_t size)
+{
+	wq->queued_bytes -= size;
+}
+
+/** Records a completed write of size bytes that took elapsed_ns */
+static inline void write_queue_add_write(struct write_queue_stats *wq,
+		size_t size, uint64_t elapsed_ns)
+{
+	wq->total_bytes    += size;
+	wq->total_write_ns += elapsed_ns;
+	wq->num_writes++;
+	if (elapsed_ns > wq->max_write_ns)
+		wq->max_write_ns = elapsed_ns;
+}
+
+static inline void write_queue_log_stats(const struct write_queue_stats *wq,
+		const char *name)
+{
+	double avg_ms = wq->num_writes ?
+		(double)wq->total_write_ns /
+		(double)wq->num_writes / 1000000.0 : 0.0;
+
+	blog(LOG_INFO, "[%s] Wrote %"PRIu64" bytes in %"PRIu64" writes, "
+	               "average write time: %.2f ms, maximum write time: "
+	               "%.2f ms, maximum queued: %.2f MB",
+	               name, wq->total_bytes, wq->num_writes, avg_ms,
+	               (double)wq->max_write_ns / 1000000.0,
+	               (double)wq->max_queued_bytes / (1024.0 * 1024.0));
+
+	if (wq->dropped_frames)
+		blog(LOG_WARNING, "[%s] Dropped %d frames because writing "
+		                  "could not keep up",
+		                  name, wq->dropped_frames);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -247,10 +247,13 @@ static void xshm_video_tick(void *vptr, float seconds)
 	if (!data->xshm)
 		return;
 
-	obs_enter_graphics();
-
+	/* the display connection belongs to this source, so the capture
+	 * itself can run without the graphics lock on a tick worker */
 	XShmGetImage(data->dpy, XRootWindowOfScreen(data->screen),
 		data->xshm->image, data->x_org, data->y_org, AllPlanes);
+
+	obs_enter_graphics();
+
 	gs_texture_set_image(data->texture, (void *) data->xshm->image->data,
 		data->width * 4, false);
 
@@ -302,7 +305,7 @@ static uint32_t xshm_getheight(void *vptr)
 struct obs_source_info xshm_input = {
 	.id             = "xshm_input",
 	.type           = OBS_SOURCE_TYPE_INPUT,
-	.output_flags   = OBS_SOURCE_VIDEO,
+	.output_flags   = OBS_SOURCE_VIDEO | OBS_SOURCE_THREADED_TICK,
 	.get_name       = xshm_getname,
 	.create         = xshm_create,
 	.destroy        = xshm_destroy,
@@ -21,6 +21,10 @@
 #include <util/dstr.h>
 #include <util/darray.h>
 #include <util/platform.h>
+#include <util/write-queue.h>
+#include <media-io/audio-framer.h>
+#include <obs-avc.h>
+#include <inttypes.h>
 
 #include <libavutil/opt.h>
 #include <libavformat/avformat.h>
@@ -32,6 +36,9 @@
 //#define OBS_FFMPEG_VIDEO_FORMAT VIDEO_FORMAT_I420
 #define OBS_FFMPEG_VIDEO_FORMAT VIDEO_FORMAT_NV12
 
+/* maximum number of packets the write thread takes off the queue at once */
+#define WRITE_BATCH_PACKETS 64
+
 /* NOTE: much of this stuff is test stuff that was more or less copied from
  * the muxing.c ffmpeg example */
 
@@ -59,13 +66,21 @@ struct ffmpeg_data {
 	enum audio_format  audio_format;
 	size_t             audio_planes;
 	size_t             audio_size;
-	struct circlebuf   excess_frames[MAX_AV_PLANES];
-	uint8_t            *samples[MAX_AV_PLANES];
+	struct audio_framer audio_framer;
 	AVFrame            *aframe;
 	int                total_samples;
 
+	/* encoded mode only: streams of each audio track, indexed by the
+	 * track of the output's audio encoder */
+	AVStream           *audio_tracks[MAX_OUTPUT_AUDIO_ENCODERS];
+
+	/* encoded mode only: converts AVCC video packets for formats that
+	 * need annex-b */
+	AVBitStreamFilterContext *annexb_filter;
+
 	const char         *filename_test;
 
+	bool               encoded;
 	bool               initialized;
 };
 
@@ -74,6 +89,9 @@ struct ffmpeg_output {
 	volatile bool      active;
 	struct ffmpeg_data ff_data;
 
+	/* muxes packets from libobs encoders instead of encoding itself */
+	bool               encoded;
+
 	bool               connecting;
 	pthread_t          start_thread;
 
@@ -83,7 +101,8 @@ struct ffmpeg_output {
 	os_sem_t           *write_sem;
 	os_event_t         *stop_event;
 
-	DARRAY(AVPacket)   packets;
+	struct circlebuf   packets;
+	struct write_queue_stats queue;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -230,14 +249,8 @@ static bool open_audio_codec(struct ffmpeg_data *data)
 
 	data->frame_size = context->frame_size ? context->frame_size : 1024;
 
-	ret = av_samples_alloc(data->samples, NULL, context->channels,
-			data->frame_size, context->sample_fmt, 0);
-	if (ret < 0) {
-		blog(LOG_WARNING, "Failed to create audio buffer: %s",
-		                av_err2str(ret));
-		return false;
-	}
-
+	audio_framer_init(&data->audio_framer, data->audio_planes,
+			(size_t)data->frame_size * data->audio_size);
 	return true;
 }
 
@@ -322,10 +335,8 @@ static void close_video(struct ffmpeg_data *data)
 
 static void close_audio(struct ffmpeg_data *data)
 {
-	for (size_t i = 0; i < MAX_AV_PLANES; i++)
-		circlebuf_free(&data->excess_frames[i]);
+	audio_framer_free(&data->audio_framer);
 
-	av_freep(&data->samples[0]);
 	avcodec_close(data->audio->codec);
 	av_frame_free(&data->aframe);
 }
@@ -335,10 +346,12 @@ static void ffmpeg_data_free(struct ffmpeg_data *data)
 	if (data->initialized)
 		av_write_trailer(data->output);
 
-	if (data->video)
+	if (data->video && !data->encoded)
 		close_video(data);
-	if (data->audio)
+	if (data->audio && !data->encoded)
 		close_audio(data);
+	if (data->annexb_filter)
+		av_bitstream_filter_close(data->annexb_filter);
 
 	if (data->output) {
 		if ((data->output->oformat->flags & AVFMT_NOFILE) == 0)
@@ -350,11 +363,35 @@ static void ffmpeg_data_free(struct ffmpeg_data *data)
 	memset(data, 0, sizeof(struct ffmpeg_data));
 }
 
+static bool new_output_context(struct ffmpeg_data *data)
+{
+	bool is_rtmp;
+
+	av_register_all();
+	avformat_network_init();
+
+	is_rtmp = (astrcmp_n(data->filename_test, "rtmp://", 7) == 0);
+
+	/* TODO: settings */
+	avformat_alloc_output_context2(&data->output, NULL,
+			is_rtmp ? "flv" : NULL, data->filename_test);
+
+	if (!data->output) {
+		blog(LOG_WARNING, "Couldn't create avformat context");
+		return false;
+	}
+
+	if (is_rtmp) {
+		data->output->oformat->video_codec = AV_CODEC_ID_H264;
+		data->output->oformat->audio_codec = AV_CODEC_ID_AAC;
+	}
+
+	return true;
+}
+
 static bool ffmpeg_data_init(struct ffmpeg_data *data, const char *filename,
 		int vbitrate, int abitrate, int width, int height)
 {
-	bool is_rtmp = false;
-
 	memset(data, 0, sizeof(struct ffmpeg_data));
 	data->filename_test = filename;
 	data->video_bitrate = vbitrate;
@@ -365,25 +402,225 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data, const char *filename,
 	if (!filename || !*filename)
 		return false;
 
-	av_register_all();
-	avformat_network_init();
+	if (!new_output_context(data))
+		goto fail;
+	if (!init_streams(data))
+		goto fail;
+	if (!open_output_file(data))
+		goto fail;
 
-	is_rtmp = (astrcmp_n(filename, "rtmp://", 7) == 0);
+	av_dump_format(data->output, 0, NULL, 1);
 
-	/* TODO: settings */
-	avformat_alloc_output_context2(&data->output, NULL,
-			is_rtmp ? "flv" : NULL, data->filename_test);
-	if (is_rtmp) {
-		data->output->oformat->video_codec = AV_CODEC_ID_H264;
-		data->output->oformat->audio_codec = AV_CODEC_ID_AAC;
+	data->initialized = true;
+	return true;
+
+fail:
+	blog(LOG_WARNING, "ffmpeg_data_init failed");
+	ffmpeg_data_free(data);
+	return false;
+}
+
+/* ------------------------------------------------------------------------- */
+/* encoded mode: streams are described from the libobs encoders and packets
+ * are only muxed */
+
+static enum AVCodecID get_codec_id(const char *codec)
+{
+	const AVCodecDescriptor *desc;
+
+	if (astrcmpi(codec, "h264") == 0)
+		return AV_CODEC_ID_H264;
+	if (astrcmpi(codec, "aac") == 0)
+		return AV_CODEC_ID_AAC;
+
+	desc = codec ? avcodec_descriptor_get_by_name(codec) : NULL;
+	return desc ? desc->id : AV_CODEC_ID_NONE;
+}
+
+static bool set_extra_data(AVCodecContext *context, obs_encoder_t *encoder)
+{
+	uint8_t *extra_data;
+	uint8_t *avcc = NULL;
+	size_t  size;
+
+	if (!obs_encoder_get_extra_data(encoder, &extra_data, &size))
+		return true;
+
+	/* the muxers expect an avcC record when the packets are AVCC framed,
+	 * otherwise they convert annex-b packets themselves */
+	if (context->codec_id == AV_CODEC_ID_H264 &&
+	    obs_encoder_avcc_enabled(encoder)) {
+		size = obs_parse_avc_header(&avcc, extra_data, size);
+		extra_data = avcc;
 	}
 
-	if (!data->output) {
-		blog(LOG_WARNING, "Couldn't create avformat context");
-		goto fail;
+	/* freed by libavformat along with the stream */
+	context->extradata = av_mallocz(size + FF_INPUT_BUFFER_PADDING_SIZE);
+	if (context->extradata) {
+		memcpy(context->extradata, extra_data, size);
+		context->extradata_size = (int)size;
 	}
 
-	if (!init_streams(data))
+	bfree(avcc);
+	return context->extradata != NULL;
+}
+
+/* these formats only take annex-b H.264, the others convert it to AVCC
+ * themselves if they need to */
+static const char *const annexb_formats[] = {
+	"mpegts",
+	"h264",
+	"hls",
+	"rtp_mpegts",
+	NULL
+};
+
+static bool needs_annexb(const AVOutputFormat *format)
+{
+	const char *const *name = annexb_formats;
+
+	while (*name) {
+		if (strcmp(format->name, *(name++)) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+static bool init_annexb_filter(struct ffmpeg_data *data,
+		obs_encoder_t *encoder)
+{
+	if (data->video->codec->codec_id != AV_CODEC_ID_H264 ||
+	    !obs_encoder_avcc_enabled(encoder) ||
+	    !needs_annexb(data->output->oformat))
+		return true;
+
+	data->annexb_filter = av_bitstream_filter_init("h264_mp4toannexb");
+	if (!data->annexb_filter) {
+		blog(LOG_WARNING, "Format '%s' needs annex-b H.264, but the "
+		                  "h264_mp4toannexb filter is not available",
+		                  data->output->oformat->name);
+		return false;
+	}
+
+	return true;
+}
+
+static AVStream *new_encoded_stream(struct ffmpeg_data *data,
+		obs_encoder_t *encoder, enum AVMediaType type)
+{
+	const char     *codec = obs_encoder_get_codec(encoder);
+	enum AVCodecID id     = get_codec_id(codec);
+	AVStream       *stream;
+
+	if (id == AV_CODEC_ID_NONE) {
+		blog(LOG_WARNING, "Unknown codec '%s' for encoder '%s'",
+				codec, obs_encoder_get_name(encoder));
+		return NULL;
+	}
+
+	stream = avformat_new_stream(data->output, NULL);
+	if (!stream) {
+		blog(LOG_WARNING, "Couldn't create stream for encoder '%s'",
+				obs_encoder_get_name(encoder));
+		return NULL;
+	}
+
+	stream->id                = data->output->nb_streams-1;
+	stream->codec->codec_id   = id;
+	stream->codec->codec_type = type;
+
+	if (data->output->oformat->flags & AVFMT_GLOBALHEADER)
+		stream->codec->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+	if (!set_extra_data(stream->codec, encoder)) {
+		blog(LOG_WARNING, "Failed to allocate extra data");
+		return NULL;
+	}
+
+	return stream;
+}
+
+static bool create_encoded_video_stream(struct ffmpeg_data *data,
+		obs_encoder_t *encoder)
+{
+	const struct video_output_info *voi;
+	AVCodecContext *context;
+
+	voi = video_output_get_info(obs_encoder_video(encoder));
+
+	data->video = new_encoded_stream(data, encoder, AVMEDIA_TYPE_VIDEO);
+	if (!data->video)
+		return false;
+
+	context                = data->video->codec;
+	context->width         = (int)obs_encoder_get_width(encoder);
+	context->height        = (int)obs_encoder_get_height(encoder);
+	context->time_base.num = voi->fps_den;
+	context->time_base.den = voi->fps_num;
+	context->pix_fmt       = AV_PIX_FMT_YUV420P;
+	data->video->time_base = context->time_base;
+	return init_annexb_filter(data, encoder);
+}
+
+static bool create_encoded_audio_stream(struct ffmpeg_data *data,
+		obs_encoder_t *encoder, size_t track)
+{
+	const struct audio_output_info *aoi;
+	AVCodecContext *context;
+	AVStream *stream;
+
+	aoi = audio_output_get_info(obs_encoder_audio(encoder));
+
+	stream = new_encoded_stream(data, encoder, AVMEDIA_TYPE_AUDIO);
+	if (!stream)
+		return false;
+
+	context                = stream->codec;
+	context->sample_rate   = aoi->samples_per_sec;
+	context->channels      = get_audio_channels(aoi->speakers);
+	context->time_base.num = 1;
+	context->time_base.den = aoi->samples_per_sec;
+	stream->time_base      = context->time_base;
+
+	data->audio_tracks[track] = stream;
+	if (!data->audio)
+		data->audio = stream;
+	return true;
+}
+
+static bool init_encoded_streams(struct ffmpeg_data *data,
+		obs_output_t *context)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
+
+	if (vencoder && !create_encoded_video_stream(data, vencoder))
+		return false;
+
+	for (size_t i = 0; i < MAX_OUTPUT_AUDIO_ENCODERS; i++) {
+		obs_encoder_t *aencoder =
+			obs_output_get_audio_track_encoder(context, i);
+
+		if (aencoder && !create_encoded_audio_stream(data, aencoder, i))
+			return false;
+	}
+
+	return true;
+}
+
+static bool ffmpeg_data_init_encoded(struct ffmpeg_data *data,
+		const char *filename, obs_output_t *context)
+{
+	memset(data, 0, sizeof(struct ffmpeg_data));
+	data->filename_test = filename;
+	data->encoded       = true;
+
+	if (!filename || !*filename)
+		return false;
+
+	if (!new_output_context(data))
+		goto fail;
+	if (!init_encoded_streams(data, context))
 		goto fail;
 	if (!open_output_file(data))
 		goto fail;
@@ -394,7 +631,7 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data, const char *filename,
 	return true;
 
 fail:
-	blog(LOG_WARNING, "ffmpeg_data_init failed");
+	blog(LOG_WARNING, "ffmpeg_data_init_encoded failed");
 	ffmpeg_data_free(data);
 	return false;
 }
@@ -440,6 +677,20 @@ fail:
 	return NULL;
 }
 
+static const char *ffmpeg_encoded_output_getname(void)
+{
+	return obs_module_text("FFmpegEncodedOutput");
+}
+
+static void *ffmpeg_encoded_output_create(obs_data_t *settings,
+		obs_output_t *output)
+{
+	struct ffmpeg_output *data = ffmpeg_output_create(settings, output);
+	if (data)
+		data->encoded = true;
+	return data;
+}
+
 static void ffmpeg_output_stop(void *data);
 
 static void ffmpeg_output_destroy(void *data)
@@ -459,6 +710,39 @@ static void ffmpeg_output_destroy(void *data)
 	}
 }
 
+static bool add_packet(struct ffmpeg_output *output, AVPacket *packet)
+{
+	bool is_video = output->ff_data.video &&
+		packet->stream_index == output->ff_data.video->index;
+
+	if (!write_queue_push(&output->queue,
+				obs_output_get_name(output->output),
+				(size_t)packet->size, is_video,
+				(packet->flags & AV_PKT_FLAG_KEY) != 0))
+		return false;
+
+	circlebuf_push_back(&output->packets, packet, sizeof(*packet));
+	return true;
+}
+
+/* the write thread empties the whole queue each time it wakes up, so it only
+ * needs to be woken when the queue goes from empty to non-empty */
+static void queue_packet(struct ffmpeg_output *output, AVPacket *packet)
+{
+	bool was_empty;
+	bool added;
+
+	pthread_mutex_lock(&output->write_mutex);
+	was_empty = output->packets.size == 0;
+	added = add_packet(output, packet);
+	pthread_mutex_unlock(&output->write_mutex);
+
+	if (!added)
+		av_free_packet(packet);
+	else if (was_empty)
+		os_sem_post(output->write_sem);
+}
+
 static inline void copy_data(AVPicture *pic, const struct video_data *frame,
 		int height)
 {
@@ -512,10 +796,7 @@ static void receive_video(void *param, struct video_data *frame)
 		packet.data          = data->dst_picture.data[0];
 		packet.size          = sizeof(AVPicture);
 
-		pthread_mutex_lock(&output->write_mutex);
-		da_push_back(output->packets, &packet);
-		pthread_mutex_unlock(&output->write_mutex);
-		os_sem_post(output->write_sem);
+		queue_packet(output, &packet);
 
 	} else {
 		data->vframe->pts = data->total_frames;
@@ -536,10 +817,7 @@ static void receive_video(void *param, struct video_data *frame)
 					context->time_base,
 					data->video->time_base);
 
-			pthread_mutex_lock(&output->write_mutex);
-			da_push_back(output->packets, &packet);
-			pthread_mutex_unlock(&output->write_mutex);
-			os_sem_post(output->write_sem);
+			queue_packet(output, &packet);
 		} else {
 			ret = 0;
 		}
@@ -553,28 +831,26 @@ static void receive_video(void *param, struct video_data *frame)
 	data->total_frames++;
 }
 
+/* the planes are used straight out of the audio framer rather than copied
+ * in to a single buffer for avcodec_fill_audio_frame */
 static void encode_audio(struct ffmpeg_output *output,
-		struct AVCodecContext *context, size_t block_size)
+		struct AVCodecContext *context, uint8_t *planes[MAX_AV_PLANES])
 {
 	struct ffmpeg_data *data = &output->ff_data;
 
 	AVPacket packet = {0};
 	int ret, got_packet;
-	size_t total_size = data->frame_size * block_size * context->channels;
 
 	data->aframe->nb_samples = data->frame_size;
 	data->aframe->pts = av_rescale_q(data->total_samples,
 			(AVRational){1, context->sample_rate},
 			context->time_base);
 
-	ret = avcodec_fill_audio_frame(data->aframe, context->channels,
-			context->sample_fmt, data->samples[0],
-			(int)total_size, 1);
-	if (ret < 0) {
-		blog(LOG_WARNING, "encode_audio: avcodec_fill_audio_frame "
-		                  "failed: %s", av_err2str(ret));
-		return;
-	}
+	for (size_t i = 0; i < data->audio_planes; i++)
+		data->aframe->data[i] = planes[i];
+
+	data->aframe->extended_data = data->aframe->data;
+	data->aframe->linesize[0]   = data->frame_size * (int)data->audio_size;
 
 	data->total_samples += data->frame_size;
 
@@ -595,10 +871,7 @@ static void encode_audio(struct ffmpeg_output *output,
 			data->audio->time_base);
 	packet.stream_index = data->audio->index;
 
-	pthread_mutex_lock(&output->write_mutex);
-	da_push_back(output->packets, &packet);
-	pthread_mutex_unlock(&output->write_mutex);
-	os_sem_post(output->write_sem);
+	queue_packet(output, &packet);
 }
 
 static bool prepare_audio(struct ffmpeg_data *data,
@@ -631,7 +904,7 @@ static void receive_audio(void *param, struct audio_data *frame)
 {
 	struct ffmpeg_output *output = param;
 	struct ffmpeg_data   *data   = &output->ff_data;
-	size_t frame_size_bytes;
+	uint8_t *planes[MAX_AV_PLANES];
 	struct audio_data in;
 
 	AVCodecContext *context = data->audio->codec;
@@ -641,51 +914,165 @@ static void receive_audio(void *param, struct audio_data *frame)
 	if (!prepare_audio(data, frame, &in))
 		return;
 
-	frame_size_bytes = (size_t)data->frame_size * data->audio_size;
+	audio_framer_push(&data->audio_framer, in.data,
+			in.frames * data->audio_size);
 
-	for (size_t i = 0; i < data->audio_planes; i++)
-		circlebuf_push_back(&data->excess_frames[i], in.data[i],
-				in.frames * data->audio_size);
+	while (audio_framer_peek(&data->audio_framer, planes)) {
+		encode_audio(output, context, planes);
+		audio_framer_pop(&data->audio_framer);
+	}
+}
 
-	while (data->excess_frames[0].size >= frame_size_bytes) {
-		for (size_t i = 0; i < data->audio_planes; i++)
-			circlebuf_pop_front(&data->excess_frames[i],
-					data->samples[i], frame_size_bytes);
+static void release_packet_data(void *opaque, uint8_t *data)
+{
+	struct encoder_packet *packet = opaque;
+
+	obs_encoder_packet_release(packet);
+	bfree(packet);
+
+	UNUSED_PARAMETER(data);
+}
 
-		encode_audio(output, context, data->audio_size);
+/* also inserts the SPS/PPS before keyframes, which formats like MPEG-TS
+ * need in band */
+static bool filter_annexb(struct ffmpeg_data *data, AVPacket *packet)
+{
+	uint8_t *out      = NULL;
+	int      out_size = 0;
+	int      ret;
+
+	ret = av_bitstream_filter_filter(data->annexb_filter,
+			data->video->codec, NULL, &out, &out_size,
+			packet->data, packet->size,
+			(packet->flags & AV_PKT_FLAG_KEY) != 0);
+	if (ret < 0)
+		return false;
+
+	/* otherwise the output points in to the packet's own data */
+	if (ret > 0) {
+		AVBufferRef *buf = av_buffer_create(out, out_size,
+				av_buffer_default_free, NULL, 0);
+		if (!buf) {
+			av_free(out);
+			return false;
+		}
+
+		av_buffer_unref(&packet->buf);
+		packet->buf = buf;
 	}
+
+	packet->data = out;
+	packet->size = out_size;
+	return true;
 }
 
-static bool process_packet(struct ffmpeg_output *output)
+static void receive_encoded(void *param, struct encoder_packet *packet)
 {
-	AVPacket packet;
-	bool new_packet = false;
-	int ret;
+	struct ffmpeg_output  *output = param;
+	struct ffmpeg_data    *data   = &output->ff_data;
+	struct encoder_packet *ref;
+	AVRational            timebase;
+	AVStream              *stream;
+	AVPacket              av_packet;
+
+	stream = (packet->type == OBS_ENCODER_VIDEO) ?
+		data->video : data->audio_tracks[packet->track_idx];
+	if (!stream)
+		return;
+
+	/* the muxer holds on to a reference of the encoder packet instead of
+	 * a copy of its data; it's released when libavformat is done with
+	 * it.  other outputs read the same data, so it's read-only */
+	ref = bmalloc(sizeof(struct encoder_packet));
+	obs_encoder_packet_ref(ref, packet);
+
+	av_init_packet(&av_packet);
+	av_packet.buf = av_buffer_create(ref->data, (int)ref->size,
+			release_packet_data, ref, AV_BUFFER_FLAG_READONLY);
+	if (!av_packet.buf) {
+		blog(LOG_WARNING, "receive_encoded: Failed to create buffer");
+		release_packet_data(ref, NULL);
+		return;
+	}
+
+	timebase.num = packet->timebase_num;
+	timebase.den = packet->timebase_den;
+
+	av_packet.data         = ref->data;
+	av_packet.size         = (int)ref->size;
+	av_packet.stream_index = stream->index;
+	av_packet.pts = av_rescale_q(packet->pts, timebase, stream->time_base);
+	av_packet.dts = av_rescale_q(packet->dts, timebase, stream->time_base);
+
+	if (packet->keyframe || packet->type == OBS_ENCODER_AUDIO)
+		av_packet.flags |= AV_PKT_FLAG_KEY;
+
+	if (packet->type == OBS_ENCODER_VIDEO && data->annexb_filter &&
+	    !filter_annexb(data, &av_packet)) {
+		blog(LOG_WARNING, "receive_encoded: Failed to convert video "
+		                  "packet to annex-b");
+		av_free_packet(&av_packet);
+		return;
+	}
+
+	queue_packet(output, &av_packet);
+}
+
+static size_t get_packet_batch(struct ffmpeg_output *output, AVPacket *batch)
+{
+	size_t count = 0;
 
 	pthread_mutex_lock(&output->write_mutex);
-	if (output->packets.num) {
-		packet = output->packets.array[0];
-		da_erase(output->packets, 0);
-		new_packet = true;
+	while (output->packets.size && count < WRITE_BATCH_PACKETS) {
+		AVPacket *packet = batch + count++;
+
+		circlebuf_pop_front(&output->packets, packet, sizeof(*packet));
+		write_queue_pop(&output->queue, (size_t)packet->size);
 	}
 	pthread_mutex_unlock(&output->write_mutex);
 
-	if (!new_packet)
-		return true;
+	return count;
+}
 
-	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
-			"packets queued: %lu",
-			packet.size, packet.flags,
-			packet.stream_index, output->packets.num);*/
+static bool write_packet(struct ffmpeg_output *output, AVPacket *packet)
+{
+	uint64_t start_time = os_gettime_ns();
+	uint64_t elapsed;
+	int      size = packet->size;
+	int      ret;
 
-	ret = av_interleaved_write_frame(output->ff_data.output, &packet);
+	ret = av_interleaved_write_frame(output->ff_data.output, packet);
 	if (ret < 0) {
-		av_free_packet(&packet);
-		blog(LOG_WARNING, "receive_audio: Error writing packet: %s",
+		av_free_packet(packet);
+		blog(LOG_WARNING, "write_packet: Error writing packet: %s",
 				av_err2str(ret));
 		return false;
 	}
 
+	elapsed = os_gettime_ns() - start_time;
+
+	write_queue_add_write(&output->queue, (size_t)size, elapsed);
+
+	return true;
+}
+
+/* takes packets off the queue in batches so the lock is only taken once per
+ * batch, and writes until the queue is empty */
+static bool process_packets(struct ffmpeg_output *output)
+{
+	AVPacket batch[WRITE_BATCH_PACKETS];
+	size_t   count;
+
+	while ((count = get_packet_batch(output, batch)) > 0) {
+		for (size_t i = 0; i < count; i++) {
+			if (!write_packet(output, batch + i)) {
+				for (size_t j = i + 1; j < count; j++)
+					av_free_packet(batch + j);
+				return false;
+			}
+		}
+	}
+
 	return true;
 }
 
@@ -694,17 +1081,20 @@ static void *write_thread(void *data)
 	struct ffmpeg_output *output = data;
 
 	while (os_sem_wait(output->write_sem) == 0) {
-		/* check to see if shutting down */
-		if (os_event_try(output->stop_event) == 0)
-			break;
+		/* check to see if shutting down; anything still queued is
+		 * written first */
+		bool stopping = os_event_try(output->stop_event) == 0;
 
-		if (!process_packet(output)) {
+		if (!process_packets(output)) {
 			pthread_detach(output->write_thread);
 			output->write_thread_active = false;
 
 			ffmpeg_output_stop(output);
 			break;
 		}
+
+		if (stopping)
+			break;
 	}
 
 	output->active = false;
@@ -764,11 +1154,52 @@ static bool try_connect(struct ffmpeg_output *output)
 	return true;
 }
 
+static bool try_connect_encoded(struct ffmpeg_output *output)
+{
+	const char *filename;
+	obs_data_t *settings;
+	int ret;
+
+	settings = obs_output_get_settings(output->output);
+	filename = obs_data_get_string(settings, "filename");
+	obs_data_release(settings);
+
+	if (!filename || !*filename)
+		return false;
+
+	if (!obs_output_can_begin_data_capture(output->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(output->output, 0))
+		return false;
+
+	/* the encoders have to be initialized first so their headers are
+	 * available when the streams are created */
+	if (!ffmpeg_data_init_encoded(&output->ff_data, filename,
+				output->output))
+		return false;
+
+	output->active = true;
+
+	ret = pthread_create(&output->write_thread, NULL, write_thread, output);
+	if (ret != 0) {
+		blog(LOG_WARNING, "ffmpeg_output_start: failed to create write "
+		                  "thread.");
+		ffmpeg_output_stop(output);
+		return false;
+	}
+
+	output->write_thread_active = true;
+	obs_output_begin_data_capture(output->output, 0);
+	return true;
+}
+
 static void *start_thread(void *data)
 {
 	struct ffmpeg_output *output = data;
+	bool success = output->encoded ?
+		try_connect_encoded(output) : try_connect(output);
 
-	if (!try_connect(output))
+	if (!success)
 		obs_output_signal_stop(output->output,
 				OBS_OUTPUT_CONNECT_FAILED);
 
@@ -784,6 +1215,8 @@ static bool ffmpeg_output_start(void *data)
 	if (output->connecting)
 		return false;
 
+	write_queue_reset(&output->queue);
+
 	ret = pthread_create(&output->start_thread, NULL, start_thread, output);
 	return (output->connecting = (ret == 0));
 }
@@ -804,24 +1237,61 @@ static void ffmpeg_output_stop(void *data)
 
 		pthread_mutex_lock(&output->write_mutex);
 
-		for (size_t i = 0; i < output->packets.num; i++)
-			av_free_packet(output->packets.array+i);
-		da_free(output->packets);
+		while (output->packets.size) {
+			AVPacket packet;
+			circlebuf_pop_front(&output->packets, &packet,
+					sizeof(packet));
+			av_free_packet(&packet);
+		}
+		circlebuf_free(&output->packets);
+		output->queue.queued_bytes = 0;
 
 		pthread_mutex_unlock(&output->write_mutex);
 
 		ffmpeg_data_free(&output->ff_data);
+		write_queue_log_stats(&output->queue,
+				obs_output_get_name(output->output));
 	}
 }
 
+static uint64_t ffmpeg_output_total_bytes(void *data)
+{
+	struct ffmpeg_output *output = data;
+	return output->queue.total_bytes;
+}
+
+static int ffmpeg_output_dropped_frames(void *data)
+{
+	struct ffmpeg_output *output = data;
+	return output->queue.dropped_frames;
+}
+
 struct obs_output_info ffmpeg_output = {
-	.id        = "ffmpeg_output",
-	.flags     = OBS_OUTPUT_AUDIO | OBS_OUTPUT_VIDEO,
-	.get_name  = ffmpeg_output_getname,
-	.create    = ffmpeg_output_create,
-	.destroy   = ffmpeg_output_destroy,
-	.start     = ffmpeg_output_start,
-	.stop      = ffmpeg_output_stop,
-	.raw_video = receive_video,
-	.raw_audio = receive_audio,
+	.id                 = "ffmpeg_output",
+	.flags              = OBS_OUTPUT_AUDIO | OBS_OUTPUT_VIDEO,
+	.get_name           = ffmpeg_output_getname,
+	.create             = ffmpeg_output_create,
+	.destroy            = ffmpeg_output_destroy,
+	.start              = ffmpeg_output_start,
+	.stop               = ffmpeg_output_stop,
+	.raw_video          = receive_video,
+	.raw_audio          = receive_audio,
+	.get_total_bytes    = ffmpeg_output_total_bytes,
+	.get_dropped_frames = ffmpeg_output_dropped_frames,
+};
+
+struct obs_output_info ffmpeg_encoded_output = {
+	.id                 = "ffmpeg_encoded_output",
+	.flags              = OBS_OUTPUT_AV |
+	                      OBS_OUTPUT_ENCODED |
+	                      OBS_OUTPUT_MULTI_TRACK |
+	                      OBS_OUTPUT_AVCC,
+	.get_name           = ffmpeg_encoded_output_getname,
+	.create             = ffmpeg_encoded_output_create,
+	.destroy            = ffmpeg_output_destroy,
+	.start              = ffmpeg_output_start,
+	.stop               = ffmpeg_output_stop,
+	.encoded_packet     = receive_encoded,
+	.get_total_bytes    = ffmpeg_output_total_bytes,
+	.get_dropped_frames = ffmpeg_output_dropped_frames,
 };
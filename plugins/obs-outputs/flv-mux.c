@@ -17,6 +17,7 @@
 
 #include <obs.h>
 #include <stdio.h>
+#include <obs-avc.h>
 #include <util/dstr.h>
 #include <util/array-serializer.h>
 #include "flv-mux.h"
@@ -29,8 +30,6 @@
 //#define DEBUG_TIMESTAMPS
 //#define WRITE_FLV_HEADER
 
-#define VIDEO_HEADER_SIZE 5
-
 static inline double encoder_bitrate(obs_encoder_t *encoder)
 {
 	obs_data_t *settings = obs_encoder_get_settings(encoder);
@@ -164,17 +163,115 @@ void flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 static int32_t last_time = 0;
 #endif
 
-static void flv_video(struct serializer *s, struct encoder_packet *packet,
+#define VIDEO_TAG_HEADER_SIZE (11 + 5)
+#define AUDIO_TAG_HEADER_SIZE (11 + 2)
+
+static inline void w_be24(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val >> 16);
+	p[1] = (uint8_t)(val >> 8);
+	p[2] = (uint8_t)val;
+}
+
+static inline void w_be32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val >> 24);
+	w_be24(p + 1, val);
+}
+
+/* segments stored in the mux buffer are added with a NULL pointer and
+ * resolved once the tag is complete, since the buffer may be reallocated
+ * while the tag is being built */
+static inline void push_buf_segment(struct flv_mux *mux, const void *data,
+		size_t size)
+{
+	struct flv_iovec iov = {NULL, size};
+
+	if (data)
+		da_push_back_array(mux->buf, data, size);
+	else
+		da_resize(mux->buf, mux->buf.num + size);
+
+	da_push_back(mux->iov, &iov);
+	mux->size += size;
+}
+
+static inline void push_data_segment(struct flv_mux *mux, const uint8_t *data,
+		size_t size)
+{
+	struct flv_iovec iov = {data, size};
+	da_push_back(mux->iov, &iov);
+	mux->size += size;
+}
+
+static void resolve_segments(struct flv_mux *mux)
+{
+	size_t offset = 0;
+
+	for (size_t i = 0; i < mux->iov.num; i++) {
+		struct flv_iovec *iov = mux->iov.array + i;
+
+		if (!iov->data) {
+			iov->data = mux->buf.array + offset;
+			offset += iov->size;
+		}
+	}
+}
+
+/* converts annex-b start codes to AVCC length prefixes.  the length
+ * prefixes are written in to the mux buffer and the NAL units themselves are
+ * referenced directly from the packet */
+static size_t push_avc_segments(struct flv_mux *mux, const uint8_t *data,
+		size_t size)
+{
+	const uint8_t *nal_start, *nal_end;
+	const uint8_t *end = data + size;
+	size_t        payload_size = 0;
+
+	nal_start = obs_avc_find_startcode(data, end);
+	while (true) {
+		uint8_t nal_size[4];
+
+		while (nal_start < end && !*(nal_start++));
+
+		if (nal_start == end)
+			break;
+
+		nal_end = obs_avc_find_startcode(nal_start, end);
+
+		w_be32(nal_size, (uint32_t)(nal_end - nal_start));
+		push_buf_segment(mux, nal_size, sizeof(nal_size));
+		push_data_segment(mux, nal_start, nal_end - nal_start);
+
+		payload_size += sizeof(nal_size) + (nal_end - nal_start);
+		nal_start = nal_end;
+	}
+
+	return payload_size;
+}
+
+static inline void write_tag_header(uint8_t *header, uint8_t type,
+		size_t data_size, int32_t time_ms)
+{
+	header[0] = type;
+	w_be24(header + 1, (uint32_t)data_size);
+	w_be24(header + 4, time_ms);
+	header[7] = (time_ms >> 24) & 0x7F;
+	w_be24(header + 8, 0);
+}
+
+static void flv_video(struct flv_mux *mux, struct encoder_packet *packet,
 		bool is_header)
 {
 	int64_t offset  = packet->pts - packet->dts;
 	int32_t time_ms = get_ms_time(packet, packet->dts);
+	size_t  payload_size;
+	uint8_t tag_size[4];
+	uint8_t *header;
 
 	if (!packet->data || !packet->size)
 		return;
 
-	s_w8(s, RTMP_PACKET_TYPE_VIDEO);
-
 #ifdef DEBUG_TIMESTAMPS
 	blog(LOG_DEBUG, "Video: %lu", time_ms);
 
@@ -184,31 +281,42 @@ static void flv_video(struct serializer *s, struct encoder_packet *packet,
 	last_time = time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)packet->size + 5);
-	s_wb24(s, time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+	push_buf_segment(mux, NULL, VIDEO_TAG_HEADER_SIZE);
+
+	/* the sequence header and packets from AVCC encoders are already in
+	 * the framing FLV wants, so they're referenced as a whole */
+	if (is_header || packet->avcc) {
+		push_data_segment(mux, packet->data, packet->size);
+		payload_size = packet->size;
+	} else {
+		payload_size = push_avc_segments(mux, packet->data,
+				packet->size);
+	}
+
+	header = mux->buf.array;
+	write_tag_header(header, RTMP_PACKET_TYPE_VIDEO, payload_size + 5,
+			time_ms);
 
 	/* these are the 5 extra bytes mentioned above */
-	s_w8(s, packet->keyframe ? 0x17 : 0x27);
-	s_w8(s, is_header ? 0 : 1);
-	s_wb24(s, get_ms_time(packet, offset));
-	s_write(s, packet->data, packet->size);
+	header[11] = packet->keyframe ? 0x17 : 0x27;
+	header[12] = is_header ? 0 : 1;
+	w_be24(header + 13, get_ms_time(packet, offset));
 
 	/* write tag size (starting byte doesnt count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) + 4 - 1);
+	w_be32(tag_size, (uint32_t)(mux->size + 4 - 1));
+	push_buf_segment(mux, tag_size, sizeof(tag_size));
 }
 
-static void flv_audio(struct serializer *s, struct encoder_packet *packet,
+static void flv_audio(struct flv_mux *mux, struct encoder_packet *packet,
 		bool is_header)
 {
 	int32_t time_ms = get_ms_time(packet, packet->dts);
+	uint8_t tag_size[4];
+	uint8_t *header;
 
 	if (!packet->data || !packet->size)
 		return;
 
-	s_w8(s, RTMP_PACKET_TYPE_AUDIO);
-
 #ifdef DEBUG_TIMESTAMPS
 	blog(LOG_DEBUG, "Audio: %lu", time_ms);
 
@@ -218,33 +326,40 @@ static void flv_audio(struct serializer *s, struct encoder_packet *packet,
 	last_time = time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)packet->size + 2);
-	s_wb24(s, time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+	push_buf_segment(mux, NULL, AUDIO_TAG_HEADER_SIZE);
+	push_data_segment(mux, packet->data, packet->size);
+
+	header = mux->buf.array;
+	write_tag_header(header, RTMP_PACKET_TYPE_AUDIO, packet->size + 2,
+			time_ms);
 
 	/* these are the two extra bytes mentioned above */
-	s_w8(s, 0xaf);
-	s_w8(s, is_header ? 0 : 1);
-	s_write(s, packet->data, packet->size);
+	header[11] = 0xaf;
+	header[12] = is_header ? 0 : 1;
 
 	/* write tag size (starting byte doesnt count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) + 4 - 1);
+	w_be32(tag_size, (uint32_t)(mux->size + 4 - 1));
+	push_buf_segment(mux, tag_size, sizeof(tag_size));
 }
 
-void flv_packet_mux(struct encoder_packet *packet,
-		uint8_t **output, size_t *size, bool is_header)
+void flv_packet_mux(struct flv_mux *mux, struct encoder_packet *packet,
+		bool is_header)
 {
-	struct array_output_data data;
-	struct serializer s;
-
-	array_output_serializer_init(&s, &data);
+	da_resize(mux->buf, 0);
+	da_resize(mux->iov, 0);
+	mux->size = 0;
 
 	if (packet->type == OBS_ENCODER_VIDEO)
-		flv_video(&s, packet, is_header);
+		flv_video(mux, packet, is_header);
 	else
-		flv_audio(&s, packet, is_header);
+		flv_audio(mux, packet, is_header);
 
-	*output = data.bytes.array;
-	*size   = data.bytes.num;
+	resolve_segments(mux);
+}
+
+void flv_mux_free(struct flv_mux *mux)
+{
+	da_free(mux->buf);
+	da_free(mux->iov);
+	mux->size = 0;
 }
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <obs.h>
+#include <util/darray.h>
 
 #define MILLISECOND_DEN   1000
 
@@ -30,5 +31,27 @@ extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
 
 extern void flv_meta_data(obs_output_t *context, uint8_t **output, size_t *size,
 		bool write_header);
-extern void flv_packet_mux(struct encoder_packet *packet,
-		uint8_t **output, size_t *size, bool is_header);
+struct flv_iovec {
+	const uint8_t *data;
+	size_t        size;
+};
+
+/*
+ * Reusable FLV tag muxer.  Each muxed tag is described as a list of
+ * segments: tag headers and AVCC length prefixes are written in to a buffer
+ * owned by the muxer, while the payload segments point directly in to the
+ * packet data, so the packet is never copied.  Segments are valid until the
+ * next call to flv_packet_mux or until the packet is released.
+ *
+ * Video packets may be either annex-b or AVCC framed (see
+ * encoder_packet::avcc), the sequence header is always AVCC.
+ */
+struct flv_mux {
+	DARRAY(uint8_t)          buf;
+	DARRAY(struct flv_iovec) iov;
+	size_t                   size;
+};
+
+extern void flv_packet_mux(struct flv_mux *mux, struct encoder_packet *packet,
+		bool is_header);
+extern void flv_mux_free(struct flv_mux *mux);
@@ -19,9 +19,11 @@
 #include <obs-module.h>
 #include <obs-avc.h>
 #include <util/platform.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
 #include <util/dstr.h>
 #include <util/threading.h>
-#include <inttypes.h>
+#include <util/write-queue.h>
 #include "flv-mux.h"
 
 #define do_log(level, format, ...) \
@@ -31,12 +33,33 @@
 #define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
 #define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
 
+/* muxed packets are buffered and written once at least this much has built
+ * up, or once the oldest buffered data is WRITE_BATCH_MAX_NS old so the file
+ * doesn't fall far behind at low bitrates */
+#define WRITE_BATCH_SIZE    (1024 * 1024)
+#define WRITE_BATCH_MAX_NS  1000000000ULL
+
 struct flv_output {
-	obs_output_t *output;
-	struct dstr  path;
-	FILE         *file;
-	bool         active;
-	int64_t      last_packet_ts;
+	obs_output_t     *output;
+	struct dstr      path;
+	FILE             *file;
+	bool             active;
+	int64_t          last_packet_ts;
+
+	pthread_mutex_t  packets_mutex;
+	struct circlebuf packets;
+
+	pthread_t        write_thread;
+	os_event_t       *write_event;
+	volatile bool    stopping;
+	bool             write_error;
+	struct flv_mux   mux;
+	DARRAY(uint8_t)  write_buf;
+	uint64_t         write_buf_ts;
+
+	/* protected by packets_mutex, except for the write statistics which
+	 * only the write thread touches */
+	struct write_queue_stats queue;
 };
 
 static const char *flv_output_getname(void)
@@ -53,6 +76,8 @@ static void flv_output_destroy(void *data)
 	if (stream->active)
 		flv_output_stop(data);
 
+	pthread_mutex_destroy(&stream->packets_mutex);
+	os_event_destroy(stream->write_event);
 	dstr_free(&stream->path);
 	bfree(stream);
 }
@@ -61,9 +86,31 @@ static void *flv_output_create(obs_data_t *settings, obs_output_t *output)
 {
 	struct flv_output *stream = bzalloc(sizeof(struct flv_output));
 	stream->output = output;
+	pthread_mutex_init_value(&stream->packets_mutex);
+
+	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&stream->write_event, OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
 
 	UNUSED_PARAMETER(settings);
 	return stream;
+
+fail:
+	flv_output_destroy(stream);
+	return NULL;
+}
+
+static inline void free_packets(struct flv_output *stream)
+{
+	while (stream->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+		obs_encoder_packet_release(&packet);
+	}
+
+	circlebuf_free(&stream->packets);
+	stream->queue.queued_bytes = 0;
 }
 
 static void flv_output_stop(void *data)
@@ -71,33 +118,72 @@ static void flv_output_stop(void *data)
 	struct flv_output *stream = data;
 
 	if (stream->active) {
+		obs_output_end_data_capture(stream->output);
+
+		/* the write thread drains the queue before exiting */
+		stream->stopping = true;
+		os_event_signal(stream->write_event);
+		pthread_join(stream->write_thread, NULL);
+
 		if (stream->file)
 			write_file_info(stream->file, stream->last_packet_ts,
 					os_ftelli64(stream->file));
 
 		fclose(stream->file);
-		obs_output_end_data_capture(stream->output);
+		free_packets(stream);
+		flv_mux_free(&stream->mux);
+		da_free(stream->write_buf);
 		stream->active = false;
 
+		write_queue_log_stats(&stream->queue,
+				obs_output_get_name(stream->output));
 		info("FLV file output complete");
 	}
 }
 
-static int write_packet(struct flv_output *stream,
+/* a failed write (a full disk, for example) stops the output with an error,
+ * the write thread exits and anything still queued is dropped on stop */
+static void flush_write_buf(struct flv_output *stream)
+{
+	uint64_t start_time;
+	uint64_t elapsed;
+	size_t   written;
+
+	if (!stream->write_buf.num || stream->write_error)
+		return;
+
+	start_time = os_gettime_ns();
+	written = fwrite(stream->write_buf.array, 1, stream->write_buf.num,
+			stream->file);
+	elapsed = os_gettime_ns() - start_time;
+
+	write_queue_add_write(&stream->queue, written, elapsed);
+
+	if (written < stream->write_buf.num) {
+		warn("Failed to write to '%s', only %u of %u bytes were "
+		     "written", stream->path.array, (unsigned)written,
+		     (unsigned)stream->write_buf.num);
+		stream->write_error = true;
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ERROR);
+	}
+
+	da_resize(stream->write_buf, 0);
+}
+
+static void write_packet(struct flv_output *stream,
 		struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t  size;
-	int     ret = 0;
+	struct flv_mux *mux = &stream->mux;
 
 	stream->last_packet_ts = get_ms_time(packet, packet->dts);
 
-	flv_packet_mux(packet, &data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
-	bfree(data);
-	obs_free_encoder_packet(packet);
+	if (!stream->write_buf.num)
+		stream->write_buf_ts = os_gettime_ns();
 
-	return ret;
+	flv_packet_mux(mux, packet, is_header);
+	for (size_t i = 0; i < mux->iov.num; i++)
+		da_push_back_array(stream->write_buf, mux->iov.array[i].data,
+				mux->iov.array[i].size);
 }
 
 static void write_meta_data(struct flv_output *stream)
@@ -106,7 +192,7 @@ static void write_meta_data(struct flv_output *stream)
 	size_t  meta_data_size;
 
 	flv_meta_data(stream->output, &meta_data, &meta_data_size, true);
-	fwrite(meta_data, 1, meta_data_size, stream->file);
+	da_push_back_array(stream->write_buf, meta_data, meta_data_size);
 	bfree(meta_data);
 }
 
@@ -122,7 +208,7 @@ static void write_audio_header(struct flv_output *stream)
 	};
 
 	obs_encoder_get_extra_data(aencoder, &header, &packet.size);
-	packet.data = bmemdup(header, packet.size);
+	packet.data = header;
 	write_packet(stream, &packet, true);
 }
 
@@ -142,6 +228,7 @@ static void write_video_header(struct flv_output *stream)
 	obs_encoder_get_extra_data(vencoder, &header, &size);
 	packet.size = obs_parse_avc_header(&packet.data, header, size);
 	write_packet(stream, &packet, true);
+	bfree(packet.data);
 }
 
 static void write_headers(struct flv_output *stream)
@@ -149,6 +236,84 @@ static void write_headers(struct flv_output *stream)
 	write_meta_data(stream);
 	write_audio_header(stream);
 	write_video_header(stream);
+	flush_write_buf(stream);
+}
+
+static bool get_next_packet(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	bool new_packet = false;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	if (stream->packets.size) {
+		circlebuf_pop_front(&stream->packets, packet,
+				sizeof(struct encoder_packet));
+		write_queue_pop(&stream->queue, packet->size);
+		new_packet = true;
+	}
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	return new_packet;
+}
+
+static inline bool write_buf_expired(struct flv_output *stream)
+{
+	return stream->write_buf.num &&
+		os_gettime_ns() - stream->write_buf_ts >= WRITE_BATCH_MAX_NS;
+}
+
+static void write_queued_packets(struct flv_output *stream, bool stopping)
+{
+	struct encoder_packet packet;
+
+	while (!stream->write_error && get_next_packet(stream, &packet)) {
+		write_packet(stream, &packet, false);
+		obs_encoder_packet_release(&packet);
+
+		if (stream->write_buf.num >= WRITE_BATCH_SIZE)
+			flush_write_buf(stream);
+	}
+
+	if (stopping || write_buf_expired(stream))
+		flush_write_buf(stream);
+}
+
+/* waits for new packets, or until the buffered data is due to be written
+ * if there is any */
+static int wait_for_packets(struct flv_output *stream)
+{
+	uint64_t age;
+	int      ret;
+
+	if (!stream->write_buf.num)
+		return os_event_wait(stream->write_event);
+
+	age = os_gettime_ns() - stream->write_buf_ts;
+	if (age >= WRITE_BATCH_MAX_NS)
+		return 0;
+
+	ret = os_event_timedwait(stream->write_event,
+			(unsigned long)((WRITE_BATCH_MAX_NS - age) / 1000000ULL));
+	return ret == ETIMEDOUT ? 0 : ret;
+}
+
+/* muxing and file writes happen on this thread so that a slow disk never
+ * blocks the encoders.  the event is only signalled when the queue goes
+ * from empty to non-empty, and each wakeup drains the whole queue */
+static void *write_thread(void *data)
+{
+	struct flv_output *stream = data;
+
+	while (wait_for_packets(stream) == 0) {
+		bool stopping = stream->stopping;
+
+		write_queued_packets(stream, stopping);
+
+		if (stopping || stream->write_error)
+			break;
+	}
+
+	return NULL;
 }
 
 static bool flv_output_start(void *data)
@@ -174,27 +339,71 @@ static bool flv_output_start(void *data)
 		return false;
 	}
 
+	stream->stopping    = false;
+	stream->write_error = false;
+	write_queue_reset(&stream->queue);
+
 	/* write headers and start capture */
-	stream->active = true;
 	write_headers(stream);
+
+	if (pthread_create(&stream->write_thread, NULL, write_thread,
+				stream) != 0) {
+		warn("Failed to create write thread");
+		fclose(stream->file);
+		stream->file = NULL;
+		return false;
+	}
+
+	stream->active = true;
 	obs_output_begin_data_capture(stream->output, 0);
 
 	info("Writing FLV file '%s'...", stream->path.array);
 	return true;
 }
 
+static bool add_packet(struct flv_output *stream,
+		struct encoder_packet *packet, bool *was_empty)
+{
+	if (!write_queue_push(&stream->queue,
+				obs_output_get_name(stream->output),
+				packet->size, packet->type == OBS_ENCODER_VIDEO,
+				packet->keyframe))
+		return false;
+
+	*was_empty = stream->packets.size == 0;
+	circlebuf_push_back(&stream->packets, packet, sizeof(*packet));
+	return true;
+}
+
 static void flv_output_data(void *data, struct encoder_packet *packet)
 {
 	struct flv_output     *stream = data;
-	struct encoder_packet parsed_packet;
-
-	if (packet->type == OBS_ENCODER_VIDEO) {
-		obs_parse_avc_packet(&parsed_packet, packet);
-		write_packet(stream, &parsed_packet, false);
-		obs_free_encoder_packet(&parsed_packet);
-	} else {
-		write_packet(stream, packet, false);
-	}
+	struct encoder_packet new_packet;
+	bool                  added_packet;
+	bool                  was_empty = false;
+
+	obs_encoder_packet_ref(&new_packet, packet);
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	added_packet = add_packet(stream, &new_packet, &was_empty);
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	if (!added_packet)
+		obs_encoder_packet_release(&new_packet);
+	else if (was_empty)
+		os_event_signal(stream->write_event);
+}
+
+static uint64_t flv_output_total_bytes(void *data)
+{
+	struct flv_output *stream = data;
+	return stream->queue.total_bytes;
+}
+
+static int flv_output_dropped_frames(void *data)
+{
+	struct flv_output *stream = data;
+	return stream->queue.dropped_frames;
 }
 
 static obs_properties_t *flv_output_properties(void *unused)
@@ -210,13 +419,16 @@ static obs_properties_t *flv_output_properties(void *unused)
 }
 
 struct obs_output_info flv_output_info = {
-	.id             = "flv_output",
-	.flags          = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
-	.get_name       = flv_output_getname,
-	.create         = flv_output_create,
-	.destroy        = flv_output_destroy,
-	.start          = flv_output_start,
-	.stop           = flv_output_stop,
-	.encoded_packet = flv_output_data,
-	.get_properties = flv_output_properties
+	.id                 = "flv_output",
+	.flags              = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED |
+	                      OBS_OUTPUT_AVCC,
+	.get_name           = flv_output_getname,
+	.create             = flv_output_create,
+	.destroy            = flv_output_destroy,
+	.start              = flv_output_start,
+	.stop               = flv_output_stop,
+	.encoded_packet     = flv_output_data,
+	.get_properties     = flv_output_properties,
+	.get_total_bytes    = flv_output_total_bytes,
+	.get_dropped_frames = flv_output_dropped_frames
 };
@@ -0,0 +1,271 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <obs-avc.h>
+#include <util/platform.h>
+#include <inttypes.h>
+#include "frame-drop.h"
+
+#define debug(format, ...) \
+	blog(LOG_DEBUG, "[frame drop: '%s'] " format, \
+			obs_output_get_name(fd->output), ##__VA_ARGS__)
+
+#define MIN_KEYFRAME_REQUEST_INTERVAL_NS 1000000000ULL
+
+bool keyframe_limiter_init(struct keyframe_limiter *limiter)
+{
+	limiter->last_request_ns = 0;
+	return pthread_mutex_init(&limiter->mutex, NULL) == 0;
+}
+
+void keyframe_limiter_free(struct keyframe_limiter *limiter)
+{
+	pthread_mutex_destroy(&limiter->mutex);
+}
+
+static bool keyframe_limiter_try(struct keyframe_limiter *limiter)
+{
+	uint64_t now = os_gettime_ns();
+	bool allowed;
+
+	pthread_mutex_lock(&limiter->mutex);
+	allowed = !limiter->last_request_ns ||
+		now - limiter->last_request_ns >=
+		MIN_KEYFRAME_REQUEST_INTERVAL_NS;
+	if (allowed)
+		limiter->last_request_ns = now;
+	pthread_mutex_unlock(&limiter->mutex);
+
+	return allowed;
+}
+
+void frame_dropper_init(struct frame_dropper *fd, obs_output_t *output,
+		struct keyframe_limiter *limiter,
+		const struct frame_drop_queue *queue_type,
+		struct circlebuf *queue)
+{
+	memset(fd, 0, sizeof(struct frame_dropper));
+	fd->output     = output;
+	fd->limiter    = limiter;
+	fd->queue_type = queue_type;
+	fd->queue      = queue;
+	fd->scratch    = bmalloc(queue_type->item_size);
+}
+
+void frame_dropper_free(struct frame_dropper *fd)
+{
+	bfree(fd->scratch);
+	fd->scratch = NULL;
+}
+
+void frame_dropper_reset(struct frame_dropper *fd, int64_t threshold_usec)
+{
+	fd->threshold_usec    = threshold_usec;
+	fd->last_dts_usec     = 0;
+	fd->min_drop_dts_usec = 0;
+	fd->min_priority      = 0;
+	fd->dropped_frames    = 0;
+}
+
+static inline size_t num_queued(struct frame_dropper *fd)
+{
+	return fd->queue->size / fd->queue_type->item_size;
+}
+
+static inline void peek_first(struct frame_dropper *fd,
+		struct frame_drop_item *info)
+{
+	circlebuf_peek_front(fd->queue, fd->scratch,
+			fd->queue_type->item_size);
+	fd->queue_type->get_item(fd->scratch, info);
+}
+
+int64_t frame_dropper_queued_duration(struct frame_dropper *fd)
+{
+	struct frame_drop_item first;
+
+	if (!fd->queue->size)
+		return 0;
+
+	peek_first(fd, &first);
+	return fd->last_dts_usec - first.dts_usec;
+}
+
+/* removes video items before end_idx in the queue whose priority is at or
+ * below max_priority, audio is always kept.  the queue is rotated once so
+ * every item is looked at in place */
+static int drop_video(struct frame_dropper *fd, int max_priority,
+		size_t end_idx)
+{
+	size_t  item_size          = fd->queue_type->item_size;
+	size_t  num_items          = num_queued(fd);
+	int64_t last_drop_dts_usec = 0;
+	int     num_frames_dropped = 0;
+
+	for (size_t i = 0; i < num_items; i++) {
+		struct frame_drop_item info;
+
+		circlebuf_pop_front(fd->queue, fd->scratch, item_size);
+		fd->queue_type->get_item(fd->scratch, &info);
+
+		last_drop_dts_usec = info.dts_usec;
+
+		if (info.type == OBS_ENCODER_VIDEO && i < end_idx &&
+		    info.priority <= max_priority) {
+			num_frames_dropped++;
+			fd->queue_type->release_item(fd->scratch);
+		} else {
+			circlebuf_push_back(fd->queue, fd->scratch, item_size);
+		}
+	}
+
+	fd->min_drop_dts_usec = last_drop_dts_usec;
+	fd->dropped_frames   += num_frames_dropped;
+
+	return num_frames_dropped;
+}
+
+static size_t find_last_keyframe(struct frame_dropper *fd)
+{
+	size_t item_size = fd->queue_type->item_size;
+	size_t num_items = num_queued(fd);
+	size_t idx       = num_items;
+
+	for (size_t i = 0; i < num_items; i++) {
+		struct frame_drop_item info;
+
+		circlebuf_pop_front(fd->queue, fd->scratch, item_size);
+		fd->queue_type->get_item(fd->scratch, &info);
+
+		if (info.type == OBS_ENCODER_VIDEO && info.keyframe)
+			idx = i;
+
+		circlebuf_push_back(fd->queue, fd->scratch, item_size);
+	}
+
+	return idx;
+}
+
+void frame_dropper_clear(struct frame_dropper *fd)
+{
+	while (fd->queue->size) {
+		circlebuf_pop_front(fd->queue, fd->scratch,
+				fd->queue_type->item_size);
+		fd->queue_type->release_item(fd->scratch);
+	}
+
+	fd->last_dts_usec     = 0;
+	fd->min_drop_dts_usec = 0;
+	fd->min_priority      = 0;
+}
+
+void frame_dropper_wait_for_keyframe(struct frame_dropper *fd)
+{
+	/* the keyframe was already asked for when the wait began */
+	if (fd->min_priority == OBS_NAL_PRIORITY_HIGHEST)
+		return;
+
+	fd->min_priority = OBS_NAL_PRIORITY_HIGHEST;
+
+	if (keyframe_limiter_try(fd->limiter))
+		obs_encoder_request_keyframe(
+				obs_output_get_video_encoder(fd->output));
+	else
+		debug("Keyframe requested less than a second ago, "
+		      "waiting for the next one");
+}
+
+static void drop_frames(struct frame_dropper *fd, bool escalate)
+{
+	size_t num_items = num_queued(fd);
+	size_t keyframe_idx;
+	int    dropped;
+
+	debug("Previous packet count: %d", (int)num_items);
+
+	if (!escalate) {
+		dropped = drop_video(fd, OBS_NAL_PRIORITY_DISPOSABLE,
+				num_items);
+		if (dropped) {
+			fd->min_priority = OBS_NAL_PRIORITY_LOW;
+			debug("Dropped %d disposable frames", dropped);
+			goto done;
+		}
+	}
+
+	keyframe_idx = find_last_keyframe(fd);
+	dropped = drop_video(fd, OBS_NAL_PRIORITY_HIGHEST, keyframe_idx);
+
+	if (keyframe_idx == num_items) {
+		frame_dropper_wait_for_keyframe(fd);
+		debug("Dropped %d frames, waiting for next keyframe", dropped);
+	} else {
+		fd->min_priority = 0;
+		debug("Dropped %d frames up to queued keyframe", dropped);
+	}
+
+done:
+	debug("New packet count: %d", (int)num_queued(fd));
+}
+
+static void check_to_drop_frames(struct frame_dropper *fd)
+{
+	struct frame_drop_item first;
+	int64_t buffer_duration_usec;
+	bool escalate;
+
+	if (num_queued(fd) < 5)
+		return;
+
+	peek_first(fd, &first);
+
+	/* do not drop frames if frames were just dropped within this time */
+	if (first.dts_usec < fd->min_drop_dts_usec)
+		return;
+
+	/* if the amount of time stored in the queued packets waiting to be
+	 * sent is higher than threshold, drop frames */
+	buffer_duration_usec = fd->last_dts_usec - first.dts_usec;
+
+	if (buffer_duration_usec > fd->threshold_usec) {
+		/* the queue filled right back up after the last drop, so
+		 * dropping disposable frames wasn't enough */
+		escalate = fd->min_drop_dts_usec &&
+			first.dts_usec - fd->min_drop_dts_usec <
+			fd->threshold_usec;
+
+		drop_frames(fd, escalate);
+		debug("dropping %" PRId64 " worth of frames",
+				buffer_duration_usec);
+	}
+}
+
+bool frame_dropper_check_video(struct frame_dropper *fd,
+		const struct frame_drop_item *item)
+{
+	check_to_drop_frames(fd);
+
+	/* if currently dropping frames, drop packets until it reaches the
+	 * desired priority */
+	if (item->priority < fd->min_priority) {
+		fd->dropped_frames++;
+		return false;
+	}
+
+	fd->min_priority = 0;
+	return true;
+}
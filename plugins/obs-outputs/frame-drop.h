@@ -0,0 +1,116 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <obs.h>
+#include <util/circlebuf.h>
+#include <util/threading.h>
+
+/*
+ * Staged frame dropping for outputs that queue packets for a connection
+ * that may not keep up.
+ *
+ *   Frames are dropped in two stages.  First only disposable frames (non-
+ * reference B-frames) are dropped, which costs smoothness but not picture.
+ * If the queue backs up again right after that, the video is skipped ahead
+ * to the newest keyframe in the queue, or, if there is none, all queued
+ * video is dropped and nothing more is queued until the next keyframe,
+ * which the encoder is asked to produce.  Keyframe requests go through a
+ * keyframe_limiter shared by all droppers of an output, so that an output
+ * that keeps falling behind can't make the encoder produce nothing but
+ * keyframes.
+ *
+ *   The queue is a circlebuf of fixed size items, which can be packets or
+ * references to them.  A frame_drop_queue describes how to read and release
+ * an item.  All calls must be made with the queue locked.
+ */
+
+struct frame_drop_item {
+	enum obs_encoder_type type;
+	int64_t               dts_usec;
+	bool                  keyframe;
+	int                   priority;
+};
+
+struct frame_drop_queue {
+	size_t item_size;
+	void (*get_item)(const void *item, struct frame_drop_item *info);
+	void (*release_item)(void *item);
+};
+
+struct keyframe_limiter {
+	pthread_mutex_t               mutex;
+	uint64_t                      last_request_ns;
+};
+
+struct frame_dropper {
+	obs_output_t                  *output;
+	struct keyframe_limiter       *limiter;
+	const struct frame_drop_queue *queue_type;
+	struct circlebuf              *queue;
+	void                          *scratch;
+
+	int64_t                       threshold_usec;
+	int64_t                       last_dts_usec;
+	int64_t                       min_drop_dts_usec;
+	int                           min_priority;
+	int                           dropped_frames;
+};
+
+/** The mutex must have been set with pthread_mutex_init_value first */
+extern bool keyframe_limiter_init(struct keyframe_limiter *limiter);
+extern void keyframe_limiter_free(struct keyframe_limiter *limiter);
+
+extern void frame_dropper_init(struct frame_dropper *fd, obs_output_t *output,
+		struct keyframe_limiter *limiter,
+		const struct frame_drop_queue *queue_type,
+		struct circlebuf *queue);
+extern void frame_dropper_free(struct frame_dropper *fd);
+
+/** Resets the drop state and counters for a new session */
+extern void frame_dropper_reset(struct frame_dropper *fd,
+		int64_t threshold_usec);
+
+/**
+ * Checks the queue before a video item is queued, and drops queued frames
+ * if it holds more than the threshold's worth.
+ *
+ * @return  false if the new frame has to be dropped as well
+ */
+extern bool frame_dropper_check_video(struct frame_dropper *fd,
+		const struct frame_drop_item *item);
+
+/** Releases all queued items and ends any wait for a keyframe */
+extern void frame_dropper_clear(struct frame_dropper *fd);
+
+/**
+ * Drops new video until the next keyframe, and asks the encoder for one
+ * unless it is already waiting or the output asked for one less than a
+ * second ago.
+ */
+extern void frame_dropper_wait_for_keyframe(struct frame_dropper *fd);
+
+/** Must be called whenever an item (audio or video) has been queued */
+static inline void frame_dropper_queued(struct frame_dropper *fd,
+		int64_t dts_usec)
+{
+	fd->last_dts_usec = dts_usec;
+}
+
+/** Returns the duration of the queued items in microseconds */
+extern int64_t frame_dropper_queued_duration(struct frame_dropper *fd);
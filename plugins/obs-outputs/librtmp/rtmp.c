@@ -5557,3 +5557,384 @@ RTMP_Write(RTMP *r, const char *buf, int size)
     }
     return size+s2;
 }
+
+#define RTMP_MAX_IOV 64
+
+#ifdef MSG_NOSIGNAL
+#define RTMP_SEND_FLAGS (MSG_DONTWAIT | MSG_NOSIGNAL)
+#else
+#define RTMP_SEND_FLAGS MSG_DONTWAIT
+#endif
+
+static int
+WriteGathered(RTMP *r, const RTMPIOVec *iov, int count)
+{
+    char *buf, *ptr;
+    int size = 0, i, ret;
+
+    for (i = 0; i < count; i++)
+        size += iov[i].iov_len;
+
+    buf = ptr = malloc(size);
+    if (!buf)
+        return FALSE;
+
+    for (i = 0; i < count; i++)
+    {
+        memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+        ptr += iov[i].iov_len;
+    }
+
+    ret = WriteN(r, buf, size);
+    free(buf);
+    return ret;
+}
+
+#ifndef _WIN32
+/* the socket is left in blocking mode for reads, sends are done with
+ * MSG_DONTWAIT and wait here for the socket to drain so that a stalled
+ * connection times out instead of blocking forever */
+static int
+WaitWritable(RTMP *r)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = r->m_sb.sb_socket;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+
+    do
+    {
+        ret = poll(&pfd, 1, r->Link.timeout * 1000);
+    }
+    while (ret < 0 && errno == EINTR);
+
+    return ret > 0 && (pfd.revents & POLLOUT);
+}
+#endif
+
+static int
+WriteV(RTMP *r, RTMPIOVec *iov, int count)
+{
+    /* encryption, TLS, HTTP tunneling and custom senders only take
+     * contiguous buffers */
+    if (r->m_sb.sb_ssl || (r->Link.protocol & RTMP_FEATURE_HTTP) ||
+            (r->m_bCustomSend && r->m_customSendFunc)
+#ifdef CRYPTO
+            || r->Link.rc4keyOut
+#endif
+       )
+        return WriteGathered(r, iov, count);
+
+    while (count > 0)
+    {
+        int i, n = count < RTMP_MAX_IOV ? count : RTMP_MAX_IOV;
+        int sockerr;
+#ifdef _WIN32
+        WSABUF vec[RTMP_MAX_IOV];
+        DWORD sent = 0;
+
+        for (i = 0; i < n; i++)
+        {
+            vec[i].buf = (CHAR *)iov[i].iov_base;
+            vec[i].len = (ULONG)iov[i].iov_len;
+        }
+
+        if (WSASend(r->m_sb.sb_socket, vec, n, &sent, 0, NULL, NULL) != 0)
+        {
+            sockerr = GetSockError();
+            if (sockerr == WSAEINTR)
+                continue;
+
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+            RTMP_Close(r);
+            return FALSE;
+        }
+#else
+        struct iovec vec[RTMP_MAX_IOV];
+        struct msghdr msg;
+        ssize_t sent;
+
+        for (i = 0; i < n; i++)
+        {
+            vec[i].iov_base = (void *)iov[i].iov_base;
+            vec[i].iov_len = iov[i].iov_len;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vec;
+        msg.msg_iovlen = n;
+
+        sent = sendmsg(r->m_sb.sb_socket, &msg, RTMP_SEND_FLAGS);
+        if (sent < 0)
+        {
+            sockerr = GetSockError();
+            if (sockerr == EINTR)
+                continue;
+
+            if ((sockerr == EAGAIN || sockerr == EWOULDBLOCK) &&
+                    WaitWritable(r))
+                continue;
+
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+            RTMP_Close(r);
+            return FALSE;
+        }
+#endif
+
+        /* skip past everything that was sent */
+        while (count > 0 && (int)sent >= iov->iov_len)
+        {
+            sent -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        if (count > 0)
+        {
+            iov->iov_base += sent;
+            iov->iov_len -= (int)sent;
+        }
+    }
+
+    return TRUE;
+}
+
+static int
+SendPacketV(RTMP *r, RTMPPacket *packet, const RTMPIOVec *data, int count,
+            int skip)
+{
+    const RTMPPacket *prevPacket;
+    uint32_t last = 0;
+    int nSize, hSize, cSize, contSize;
+    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    char cont[3];
+    uint32_t t;
+    RTMPIOVec iov[RTMP_MAX_IOV];
+    int num = 0, chunkLeft, bodyLeft, i;
+
+    if (packet->m_nChannel >= r->m_channelsAllocatedOut)
+    {
+        int n = packet->m_nChannel + 10;
+        RTMPPacket **packets = realloc(r->m_vecChannelsOut, sizeof(RTMPPacket*) * n);
+        if (!packets)
+        {
+            free(r->m_vecChannelsOut);
+            r->m_vecChannelsOut = NULL;
+            r->m_channelsAllocatedOut = 0;
+            return FALSE;
+        }
+        r->m_vecChannelsOut = packets;
+        memset(r->m_vecChannelsOut + r->m_channelsAllocatedOut, 0, sizeof(RTMPPacket*) * (n - r->m_channelsAllocatedOut));
+        r->m_channelsAllocatedOut = n;
+    }
+
+    prevPacket = r->m_vecChannelsOut[packet->m_nChannel];
+    if (prevPacket && packet->m_headerType != RTMP_PACKET_SIZE_LARGE)
+    {
+        /* compress a bit by using the prev packet's attributes */
+        if (prevPacket->m_nBodySize == packet->m_nBodySize
+                && prevPacket->m_packetType == packet->m_packetType
+                && packet->m_headerType == RTMP_PACKET_SIZE_MEDIUM)
+            packet->m_headerType = RTMP_PACKET_SIZE_SMALL;
+
+        if (prevPacket->m_nTimeStamp == packet->m_nTimeStamp
+                && packet->m_headerType == RTMP_PACKET_SIZE_SMALL)
+            packet->m_headerType = RTMP_PACKET_SIZE_MINIMUM;
+        last = prevPacket->m_nTimeStamp;
+    }
+
+    nSize = packetSize[packet->m_headerType];
+    hSize = nSize;
+    cSize = 0;
+    t = packet->m_nTimeStamp - last;
+
+    header = hbuf + 6;
+    hend = hbuf + sizeof(hbuf);
+
+    if (packet->m_nChannel > 319)
+        cSize = 2;
+    else if (packet->m_nChannel > 63)
+        cSize = 1;
+    if (cSize)
+    {
+        header -= cSize;
+        hSize += cSize;
+    }
+
+    if (nSize > 1 && t >= 0xffffff)
+    {
+        header -= 4;
+        hSize += 4;
+    }
+
+    hptr = header;
+    c = packet->m_headerType << 6;
+    switch (cSize)
+    {
+    case 0:
+        c |= packet->m_nChannel;
+        break;
+    case 1:
+        break;
+    case 2:
+        c |= 1;
+        break;
+    }
+    *hptr++ = c;
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        *hptr++ = tmp & 0xff;
+        if (cSize == 2)
+            *hptr++ = tmp >> 8;
+    }
+
+    if (nSize > 1)
+        hptr = AMF_EncodeInt24(hptr, hend, t > 0xffffff ? 0xffffff : t);
+
+    if (nSize > 4)
+    {
+        hptr = AMF_EncodeInt24(hptr, hend, packet->m_nBodySize);
+        *hptr++ = packet->m_packetType;
+    }
+
+    if (nSize > 8)
+        hptr += EncodeInt32LE(hptr, packet->m_nInfoField2);
+
+    if (nSize > 1 && t >= 0xffffff)
+        hptr = AMF_EncodeInt32(hptr, hend, t);
+
+    /* every continuation chunk uses the same header, so it's built once
+     * and referenced for each chunk */
+    contSize = 1 + cSize;
+    cont[0] = (0xc0 | c);
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        cont[1] = tmp & 0xff;
+        if (cSize == 2)
+            cont[2] = tmp >> 8;
+    }
+
+#define PUSH_IOV(ptr, len) \
+    do { \
+        if (num == RTMP_MAX_IOV) \
+        { \
+            if (!WriteV(r, iov, num)) \
+                return FALSE; \
+            num = 0; \
+        } \
+        iov[num].iov_base = (ptr); \
+        iov[num].iov_len = (len); \
+        num++; \
+    } while (0)
+
+    PUSH_IOV(header, hSize);
+
+    chunkLeft = r->m_outChunkSize;
+    bodyLeft = packet->m_nBodySize;
+
+    for (i = 0; i < count && bodyLeft > 0; i++)
+    {
+        const char *ptr = data[i].iov_base;
+        int len = data[i].iov_len;
+
+        if (skip >= len)
+        {
+            skip -= len;
+            continue;
+        }
+
+        ptr += skip;
+        len -= skip;
+        skip = 0;
+
+        if (len > bodyLeft)
+            len = bodyLeft;
+        bodyLeft -= len;
+
+        while (len > 0)
+        {
+            int n;
+
+            if (!chunkLeft)
+            {
+                PUSH_IOV(cont, contSize);
+                chunkLeft = r->m_outChunkSize;
+            }
+
+            n = len < chunkLeft ? len : chunkLeft;
+            PUSH_IOV(ptr, n);
+
+            ptr += n;
+            len -= n;
+            chunkLeft -= n;
+        }
+    }
+
+#undef PUSH_IOV
+
+    if (num && !WriteV(r, iov, num))
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    return TRUE;
+}
+
+int
+RTMP_WriteV(RTMP *r, const RTMPIOVec *iov, int count)
+{
+    RTMPPacket pkt;
+    const unsigned char *buf;
+    int size = 0, i;
+
+    for (i = 0; i < count; i++)
+        size += iov[i].iov_len;
+
+    if (count < 1 || iov[0].iov_len < 11)
+        return 0;
+
+    buf = (const unsigned char *)iov[0].iov_base;
+
+    /* metadata needs the @setDataFrame prefix, let RTMP_Write handle it */
+    if (buf[0] == RTMP_PACKET_TYPE_INFO)
+    {
+        char *tmp = malloc(size), *ptr = tmp;
+        int ret;
+
+        if (!tmp)
+            return -1;
+
+        for (i = 0; i < count; i++)
+        {
+            memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+            ptr += iov[i].iov_len;
+        }
+
+        ret = RTMP_Write(r, tmp, size);
+        free(tmp);
+        return ret;
+    }
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.m_nChannel = 0x04;	/* source channel */
+    pkt.m_nInfoField2 = r->m_stream_id;
+    pkt.m_packetType = buf[0];
+    pkt.m_nBodySize = AMF_DecodeInt24((const char *)buf + 1);
+    pkt.m_nTimeStamp = AMF_DecodeInt24((const char *)buf + 4);
+    pkt.m_nTimeStamp |= (uint32_t)buf[7] << 24;
+
+    pkt.m_headerType = pkt.m_nTimeStamp ?
+        RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+
+    if (!SendPacketV(r, &pkt, iov, count, 11))
+        return -1;
+
+    return size;
+}
@@ -147,6 +147,12 @@ extern "C"
         void *sb_ssl;
     } RTMPSockBuf;
 
+    typedef struct RTMPIOVec
+    {
+        const char *iov_base;
+        int iov_len;
+    } RTMPIOVec;
+
     void RTMPPacket_Reset(RTMPPacket *p);
     void RTMPPacket_Dump(RTMPPacket *p);
     int RTMPPacket_Alloc(RTMPPacket *p, int nSize);
@@ -405,6 +411,12 @@ extern "C"
     int RTMP_Read(RTMP *r, char *buf, int size);
     int RTMP_Write(RTMP *r, const char *buf, int size);
 
+    /* Writes a single FLV tag that is split in to multiple segments.  The
+     * first segment must contain the whole 11 byte tag header.  Chunk
+     * headers are sent from a side buffer alongside the tag data, so the
+     * tag is never copied. */
+    int RTMP_WriteV(RTMP *r, const RTMPIOVec *iov, int count);
+
     /* hashswf.c */
     int RTMP_HashSWF(const char *url, unsigned int *size, unsigned char *hash,
                      int age);
@@ -61,6 +61,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/times.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <netinet/in.h>
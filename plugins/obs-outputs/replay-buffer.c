@@ -0,0 +1,494 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/platform.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+#include <inttypes.h>
+#include "flv-mux.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[replay buffer: '%s'] " format, \
+			obs_output_get_name(rb->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+
+#define OPT_MAX_TIME      "max_time_sec"
+#define OPT_MAX_SIZE      "max_size_mb"
+#define OPT_DIRECTORY     "directory"
+
+struct replay_buffer {
+	obs_output_t     *output;
+	bool             active;
+
+	pthread_mutex_t  packets_mutex;
+	struct circlebuf packets;
+	size_t           num_keyframes;
+	size_t           cur_size;
+	int64_t          last_dts_usec;
+
+	int64_t          max_time_usec;
+	size_t           max_size;
+	struct dstr      directory;
+
+	pthread_t        save_thread;
+	bool             save_thread_active;
+	volatile bool    saving;
+	DARRAY(struct encoder_packet) save_packets;
+	struct dstr      save_path;
+	struct flv_mux   save_mux;
+};
+
+static const char *replay_buffer_getname(void)
+{
+	return obs_module_text("ReplayBuffer");
+}
+
+static inline size_t num_buffered_packets(struct replay_buffer *rb)
+{
+	return rb->packets.size / sizeof(struct encoder_packet);
+}
+
+static inline bool is_keyframe(const struct encoder_packet *packet)
+{
+	return packet->type == OBS_ENCODER_VIDEO && packet->keyframe;
+}
+
+static void pop_packet(struct replay_buffer *rb)
+{
+	struct encoder_packet packet;
+	circlebuf_pop_front(&rb->packets, &packet, sizeof(packet));
+
+	if (is_keyframe(&packet))
+		rb->num_keyframes--;
+
+	rb->cur_size -= packet.size;
+	obs_encoder_packet_release(&packet);
+}
+
+static void free_packets(struct replay_buffer *rb)
+{
+	while (rb->packets.size)
+		pop_packet(rb);
+
+	circlebuf_free(&rb->packets);
+	rb->num_keyframes = 0;
+	rb->cur_size      = 0;
+}
+
+static inline void free_save_packets(struct replay_buffer *rb)
+{
+	for (size_t i = 0; i < rb->save_packets.num; i++)
+		obs_encoder_packet_release(rb->save_packets.array+i);
+	da_free(rb->save_packets);
+}
+
+static inline void join_save_thread(struct replay_buffer *rb)
+{
+	if (rb->save_thread_active) {
+		pthread_join(rb->save_thread, NULL);
+		rb->save_thread_active = false;
+	}
+}
+
+static void replay_buffer_stop(void *data);
+
+static void replay_buffer_destroy(void *data)
+{
+	struct replay_buffer *rb = data;
+
+	if (rb->active)
+		replay_buffer_stop(data);
+
+	join_save_thread(rb);
+	free_save_packets(rb);
+	free_packets(rb);
+
+	pthread_mutex_destroy(&rb->packets_mutex);
+	dstr_free(&rb->directory);
+	dstr_free(&rb->save_path);
+	flv_mux_free(&rb->save_mux);
+	bfree(rb);
+}
+
+static void replay_buffer_update(void *data, obs_data_t *settings)
+{
+	struct replay_buffer *rb = data;
+
+	pthread_mutex_lock(&rb->packets_mutex);
+	rb->max_time_usec = obs_data_get_int(settings, OPT_MAX_TIME) *
+		1000000LL;
+	rb->max_size      = (size_t)obs_data_get_int(settings, OPT_MAX_SIZE) *
+		1024 * 1024;
+	dstr_copy(&rb->directory, obs_data_get_string(settings,
+				OPT_DIRECTORY));
+	pthread_mutex_unlock(&rb->packets_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void write_packet(struct replay_buffer *rb, FILE *file,
+		struct encoder_packet *packet, bool is_header)
+{
+	struct flv_mux *mux = &rb->save_mux;
+
+	flv_packet_mux(mux, packet, is_header);
+	for (size_t i = 0; i < mux->iov.num; i++)
+		fwrite(mux->iov.array[i].data, 1, mux->iov.array[i].size,
+				file);
+}
+
+static void write_headers(struct replay_buffer *rb, FILE *file)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(rb->output);
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(rb->output);
+	uint8_t       *meta_data;
+	size_t        meta_data_size;
+	uint8_t       *header;
+	size_t        size;
+
+	struct encoder_packet audio = {
+		.type         = OBS_ENCODER_AUDIO,
+		.timebase_den = 1
+	};
+	struct encoder_packet video = {
+		.type         = OBS_ENCODER_VIDEO,
+		.timebase_den = 1,
+		.keyframe     = true
+	};
+
+	flv_meta_data(rb->output, &meta_data, &meta_data_size, true);
+	fwrite(meta_data, 1, meta_data_size, file);
+	bfree(meta_data);
+
+	obs_encoder_get_extra_data(aencoder, &header, &audio.size);
+	audio.data = header;
+	write_packet(rb, file, &audio, true);
+
+	obs_encoder_get_extra_data(vencoder, &header, &size);
+	video.size = obs_parse_avc_header(&video.data, header, size);
+	write_packet(rb, file, &video, true);
+	bfree(video.data);
+}
+
+/* the buffered packets keep the output's timestamps, so they are rebased to
+ * the first keyframe of the window to make the file start at 0 */
+static inline void rebase_packet(struct encoder_packet *packet,
+		int64_t start_usec)
+{
+	int64_t offset = start_usec * packet->timebase_den / 1000000;
+	packet->dts -= offset;
+	packet->pts -= offset;
+}
+
+static void *save_thread(void *data)
+{
+	struct replay_buffer *rb = data;
+	struct calldata      params = {0};
+	int64_t              start_usec = 0;
+	int64_t              last_ts    = 0;
+	size_t               start      = 0;
+	FILE                 *file;
+
+	file = os_fopen(rb->save_path.array, "wb");
+	if (!file) {
+		warn("Unable to open replay file '%s'", rb->save_path.array);
+		goto finish;
+	}
+
+	while (start < rb->save_packets.num &&
+	       !is_keyframe(rb->save_packets.array+start))
+		start++;
+
+	if (start < rb->save_packets.num)
+		start_usec = rb->save_packets.array[start].dts_usec;
+
+	write_headers(rb, file);
+
+	for (size_t i = start; i < rb->save_packets.num; i++) {
+		struct encoder_packet packet = rb->save_packets.array[i];
+
+		if (packet.dts_usec < start_usec)
+			continue;
+
+		rebase_packet(&packet, start_usec);
+		last_ts = get_ms_time(&packet, packet.dts);
+
+		write_packet(rb, file, &packet, false);
+	}
+
+	write_file_info(file, last_ts, os_ftelli64(file));
+	fclose(file);
+
+	info("Saved replay to '%s'", rb->save_path.array);
+
+	calldata_set_ptr(&params, "output", rb->output);
+	calldata_set_string(&params, "path", rb->save_path.array);
+	signal_handler_signal(obs_output_get_signal_handler(rb->output),
+			"saved", &params);
+	calldata_free(&params);
+
+finish:
+	free_save_packets(rb);
+
+	pthread_mutex_lock(&rb->packets_mutex);
+	rb->saving = false;
+	pthread_mutex_unlock(&rb->packets_mutex);
+	return NULL;
+}
+
+/* replays are always saved as FLV.  MP4 would need libavformat, which only
+ * the ffmpeg plugin links against, and its encoded output can only mux
+ * packets live from the encoders rather than from this buffer */
+static void make_save_path(struct replay_buffer *rb)
+{
+	char      name[64];
+	time_t    now = time(NULL);
+	struct tm *cur_time = localtime(&now);
+
+	strftime(name, sizeof(name), "Replay %Y-%m-%d %H-%M-%S.flv", cur_time);
+
+	dstr_copy_dstr(&rb->save_path, &rb->directory);
+	dstr_replace(&rb->save_path, "\\", "/");
+	if (rb->save_path.len && dstr_end(&rb->save_path) != '/')
+		dstr_cat_ch(&rb->save_path, '/');
+	dstr_cat(&rb->save_path, name);
+}
+
+static const char *check_can_save(struct replay_buffer *rb)
+{
+	if (!rb->active)
+		return "output is not active";
+	if (rb->saving)
+		return "a replay is already being saved";
+	if (dstr_is_empty(&rb->directory))
+		return "no directory is set";
+	return NULL;
+}
+
+/* takes a reference to every buffered packet and writes them out on a
+ * separate thread, so encoding and buffering continue while saving */
+static void replay_buffer_save(void *data, calldata_t *cd)
+{
+	struct replay_buffer *rb = data;
+	const char *error;
+	size_t num;
+	int ret;
+
+	/* 'saving' is tested and set under the lock, and the save thread is
+	 * started under it, so concurrent save calls can't both start a save */
+	pthread_mutex_lock(&rb->packets_mutex);
+
+	error = check_can_save(rb);
+	if (error) {
+		pthread_mutex_unlock(&rb->packets_mutex);
+		warn("Cannot save replay: %s", error);
+		return;
+	}
+
+	rb->saving = true;
+	join_save_thread(rb);
+
+	make_save_path(rb);
+
+	num = num_buffered_packets(rb);
+	da_reserve(rb->save_packets, num);
+
+	for (size_t i = 0; i < num; i++) {
+		struct encoder_packet packet;
+		struct encoder_packet *ref = da_push_back_new(rb->save_packets);
+
+		circlebuf_pop_front(&rb->packets, &packet, sizeof(packet));
+		circlebuf_push_back(&rb->packets, &packet, sizeof(packet));
+		obs_encoder_packet_ref(ref, &packet);
+	}
+
+	calldata_set_string(cd, "path", rb->save_path.array);
+
+	ret = pthread_create(&rb->save_thread, NULL, save_thread, rb);
+	if (ret != 0) {
+		warn("Failed to create save thread");
+		free_save_packets(rb);
+		rb->saving = false;
+	} else {
+		rb->save_thread_active = true;
+	}
+
+	pthread_mutex_unlock(&rb->packets_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void *replay_buffer_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct replay_buffer *rb = bzalloc(sizeof(struct replay_buffer));
+	proc_handler_t *ph = obs_output_get_proc_handler(output);
+	signal_handler_t *sh = obs_output_get_signal_handler(output);
+
+	rb->output = output;
+	pthread_mutex_init_value(&rb->packets_mutex);
+
+	if (pthread_mutex_init(&rb->packets_mutex, NULL) != 0)
+		goto fail;
+
+	replay_buffer_update(rb, settings);
+
+	proc_handler_add(ph, "void save(out string path)",
+			replay_buffer_save, rb);
+	signal_handler_add(sh, "void saved(ptr output, string path)");
+	return rb;
+
+fail:
+	replay_buffer_destroy(rb);
+	return NULL;
+}
+
+static bool replay_buffer_start(void *data)
+{
+	struct replay_buffer *rb = data;
+
+	if (!obs_output_can_begin_data_capture(rb->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(rb->output, 0))
+		return false;
+
+	rb->last_dts_usec = 0;
+	rb->active = true;
+	obs_output_begin_data_capture(rb->output, 0);
+
+	info("Replay buffer started (%d seconds, %d MB)",
+			(int)(rb->max_time_usec / 1000000),
+			(int)(rb->max_size / (1024 * 1024)));
+	return true;
+}
+
+static void replay_buffer_stop(void *data)
+{
+	struct replay_buffer *rb = data;
+
+	if (rb->active) {
+		obs_output_end_data_capture(rb->output);
+		rb->active = false;
+
+		pthread_mutex_lock(&rb->packets_mutex);
+		free_packets(rb);
+		pthread_mutex_unlock(&rb->packets_mutex);
+
+		info("Replay buffer stopped");
+	}
+}
+
+static inline bool over_limit(struct replay_buffer *rb)
+{
+	struct encoder_packet first;
+
+	if (rb->max_size && rb->cur_size > rb->max_size)
+		return true;
+
+	circlebuf_peek_front(&rb->packets, &first, sizeof(first));
+	return rb->last_dts_usec - first.dts_usec > rb->max_time_usec;
+}
+
+/* whole GOPs are removed from the front of the buffer so the buffer always
+ * starts on a keyframe, and the newest GOP is always kept */
+static void evict_packets(struct replay_buffer *rb)
+{
+	while (rb->num_keyframes > 1 && over_limit(rb)) {
+		pop_packet(rb);
+
+		while (rb->packets.size) {
+			struct encoder_packet first;
+			circlebuf_peek_front(&rb->packets, &first,
+					sizeof(first));
+
+			if (is_keyframe(&first))
+				break;
+
+			pop_packet(rb);
+		}
+	}
+}
+
+static void replay_buffer_data(void *data, struct encoder_packet *packet)
+{
+	struct replay_buffer  *rb = data;
+	struct encoder_packet ref;
+
+	pthread_mutex_lock(&rb->packets_mutex);
+
+	/* wait for the first keyframe so the buffer never starts mid-GOP */
+	if (!rb->num_keyframes && !is_keyframe(packet)) {
+		pthread_mutex_unlock(&rb->packets_mutex);
+		return;
+	}
+
+	obs_encoder_packet_ref(&ref, packet);
+	circlebuf_push_back(&rb->packets, &ref, sizeof(ref));
+
+	if (is_keyframe(&ref))
+		rb->num_keyframes++;
+
+	rb->cur_size      += ref.size;
+	rb->last_dts_usec  = ref.dts_usec;
+
+	evict_packets(rb);
+
+	pthread_mutex_unlock(&rb->packets_mutex);
+}
+
+static void replay_buffer_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_int(defaults, OPT_MAX_TIME, 20);
+	obs_data_set_default_int(defaults, OPT_MAX_SIZE, 512);
+}
+
+static obs_properties_t *replay_buffer_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_int(props, OPT_MAX_TIME,
+			obs_module_text("ReplayBuffer.MaxTime"), 1, 21600, 1);
+	obs_properties_add_int(props, OPT_MAX_SIZE,
+			obs_module_text("ReplayBuffer.MaxSize"), 0, 65536, 1);
+	obs_properties_add_text(props, OPT_DIRECTORY,
+			obs_module_text("ReplayBuffer.Directory"),
+			OBS_TEXT_DEFAULT);
+	return props;
+}
+
+struct obs_output_info replay_buffer_info = {
+	.id             = "replay_buffer",
+	.flags          = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED | OBS_OUTPUT_AVCC,
+	.get_name       = replay_buffer_getname,
+	.create         = replay_buffer_create,
+	.destroy        = replay_buffer_destroy,
+	.start          = replay_buffer_start,
+	.stop           = replay_buffer_stop,
+	.update         = replay_buffer_update,
+	.encoded_packet = replay_buffer_data,
+	.get_defaults   = replay_buffer_defaults,
+	.get_properties = replay_buffer_properties
+};
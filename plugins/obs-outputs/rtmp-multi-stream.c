@@ -0,0 +1,825 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/platform.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+#include <inttypes.h>
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+#include "flv-mux.h"
+#include "frame-drop.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[rtmp multi stream: '%s'] " format, \
+			obs_output_get_name(multi->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+#define debug(format, ...) do_log(LOG_DEBUG,   format, ##__VA_ARGS__)
+
+#define OPT_TARGETS        "targets"
+#define OPT_DROP_THRESHOLD "drop_threshold_ms"
+#define OPT_RETRY_DELAY    "retry_delay_sec"
+#define OPT_MAX_RETRIES    "max_retries"
+
+/*
+ * Streams the same encoded audio/video to several RTMP servers at once.
+ *
+ * Every packet is muxed exactly once in to a reference counted FLV tag,
+ * which is then queued to each destination.  Each destination has its own
+ * connection, send thread, queue and frame dropping, so a slow server
+ * doesn't hold back the others.  A destination that disconnects reconnects
+ * on its own and resumes from the next keyframe, without touching the
+ * others.  The output stops once every destination has given up.
+ *
+ * Destinations are given as an array of objects in the "targets" setting,
+ * each with "url", "key" and optionally "username" and "password".
+ */
+
+struct rtmp_tag {
+	volatile long         refs;
+	enum obs_encoder_type type;
+	int64_t               dts_usec;
+	bool                  keyframe;
+	int                   priority;
+	uint8_t               *data;
+	size_t                size;
+};
+
+struct rtmp_multi;
+
+struct rtmp_target {
+	struct rtmp_multi *multi;
+
+	struct dstr       url, key;
+	struct dstr       username, password;
+
+	pthread_t         send_thread;
+	bool              thread_created;
+	os_sem_t          *send_sem;
+
+	bool              connected;
+	volatile bool     disconnected;
+
+	pthread_mutex_t   tags_mutex;
+	struct circlebuf  tags;
+	struct frame_dropper dropper;
+
+	uint64_t          total_bytes_sent;
+
+	RTMP              rtmp;
+};
+
+struct rtmp_multi {
+	obs_output_t      *output;
+
+	DARRAY(struct rtmp_target*) targets;
+
+	bool              connecting;
+	pthread_t         connect_thread;
+	os_sem_t          *connect_sem;
+
+	bool              active;
+	volatile long     num_connected;
+	os_event_t        *stop_event;
+
+	struct flv_mux    mux;
+	uint8_t           *meta_data;
+	size_t            meta_data_size;
+	struct rtmp_tag   *audio_header;
+	struct rtmp_tag   *video_header;
+
+	int64_t           drop_threshold_usec;
+	struct keyframe_limiter keyframe_limiter;
+	int               retry_delay_sec;
+	int               max_retries;
+};
+
+static const char *rtmp_multi_getname(void)
+{
+	return obs_module_text("RTMPMultiStream");
+}
+
+static void log_rtmp(int level, const char *format, va_list args)
+{
+	if (level > RTMP_LOGWARNING)
+		return;
+
+	blogva(LOG_INFO, format, args);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static struct rtmp_tag *create_tag(const struct flv_mux *mux,
+		const struct encoder_packet *packet)
+{
+	struct rtmp_tag *tag  = bmalloc(sizeof(struct rtmp_tag) + mux->size);
+	uint8_t         *data = (uint8_t*)(tag + 1);
+
+	tag->refs     = 1;
+	tag->type     = packet->type;
+	tag->dts_usec = packet->dts_usec;
+	tag->keyframe = packet->keyframe;
+	tag->priority = packet->priority;
+	tag->data     = data;
+	tag->size     = mux->size;
+
+	for (size_t i = 0; i < mux->iov.num; i++) {
+		memcpy(data, mux->iov.array[i].data, mux->iov.array[i].size);
+		data += mux->iov.array[i].size;
+	}
+
+	return tag;
+}
+
+static inline void tag_addref(struct rtmp_tag *tag)
+{
+	os_atomic_inc_long(&tag->refs);
+}
+
+static inline void tag_release(struct rtmp_tag *tag)
+{
+	if (tag && os_atomic_dec_long(&tag->refs) == 0)
+		bfree(tag);
+}
+
+static void get_drop_item(const void *item, struct frame_drop_item *info)
+{
+	const struct rtmp_tag *tag = *(struct rtmp_tag *const*)item;
+
+	info->type     = tag->type;
+	info->dts_usec = tag->dts_usec;
+	info->keyframe = tag->keyframe;
+	info->priority = tag->priority;
+}
+
+static void release_drop_item(void *item)
+{
+	tag_release(*(struct rtmp_tag**)item);
+}
+
+static const struct frame_drop_queue tag_queue = {
+	.item_size    = sizeof(struct rtmp_tag*),
+	.get_item     = get_drop_item,
+	.release_item = release_drop_item
+};
+
+/* ------------------------------------------------------------------------- */
+
+static inline void free_tags(struct rtmp_target *target)
+{
+	frame_dropper_clear(&target->dropper);
+}
+
+static void target_destroy(struct rtmp_target *target)
+{
+	if (!target)
+		return;
+
+	free_tags(target);
+	circlebuf_free(&target->tags);
+	frame_dropper_free(&target->dropper);
+	pthread_mutex_destroy(&target->tags_mutex);
+	os_sem_destroy(target->send_sem);
+	dstr_free(&target->url);
+	dstr_free(&target->key);
+	dstr_free(&target->username);
+	dstr_free(&target->password);
+	bfree(target);
+}
+
+static struct rtmp_target *target_create(struct rtmp_multi *multi,
+		obs_data_t *item)
+{
+	struct rtmp_target *target = bzalloc(sizeof(struct rtmp_target));
+	target->multi = multi;
+	pthread_mutex_init_value(&target->tags_mutex);
+	frame_dropper_init(&target->dropper, multi->output,
+			&multi->keyframe_limiter, &tag_queue, &target->tags);
+	frame_dropper_reset(&target->dropper, multi->drop_threshold_usec);
+
+	dstr_copy(&target->url,      obs_data_get_string(item, "url"));
+	dstr_copy(&target->key,      obs_data_get_string(item, "key"));
+	dstr_copy(&target->username, obs_data_get_string(item, "username"));
+	dstr_copy(&target->password, obs_data_get_string(item, "password"));
+
+	if (pthread_mutex_init(&target->tags_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&target->send_sem, 0) != 0)
+		goto fail;
+
+	RTMP_Init(&target->rtmp);
+	return target;
+
+fail:
+	target_destroy(target);
+	return NULL;
+}
+
+static void free_targets(struct rtmp_multi *multi)
+{
+	for (size_t i = 0; i < multi->targets.num; i++) {
+		struct rtmp_target *target = multi->targets.array[i];
+
+		if (target->thread_created)
+			pthread_join(target->send_thread, NULL);
+		RTMP_Close(&target->rtmp);
+		target_destroy(target);
+	}
+
+	da_resize(multi->targets, 0);
+}
+
+static void free_headers(struct rtmp_multi *multi)
+{
+	tag_release(multi->audio_header);
+	tag_release(multi->video_header);
+	bfree(multi->meta_data);
+
+	multi->audio_header   = NULL;
+	multi->video_header   = NULL;
+	multi->meta_data      = NULL;
+	multi->meta_data_size = 0;
+}
+
+static void rtmp_multi_stop(void *data);
+
+static void rtmp_multi_destroy(void *data)
+{
+	struct rtmp_multi *multi = data;
+
+	if (multi) {
+		if (multi->active || multi->connecting)
+			rtmp_multi_stop(multi);
+
+		free_targets(multi);
+		free_headers(multi);
+		da_free(multi->targets);
+		flv_mux_free(&multi->mux);
+		os_sem_destroy(multi->connect_sem);
+		os_event_destroy(multi->stop_event);
+		keyframe_limiter_free(&multi->keyframe_limiter);
+		bfree(multi);
+	}
+}
+
+static void *rtmp_multi_create(obs_data_t *settings, obs_output_t *output)
+{
+	struct rtmp_multi *multi = bzalloc(sizeof(struct rtmp_multi));
+	multi->output = output;
+	pthread_mutex_init_value(&multi->keyframe_limiter.mutex);
+
+	RTMP_LogSetCallback(log_rtmp);
+	RTMP_LogSetLevel(RTMP_LOGWARNING);
+
+	if (os_event_init(&multi->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+	if (!keyframe_limiter_init(&multi->keyframe_limiter))
+		goto fail;
+
+	UNUSED_PARAMETER(settings);
+	return multi;
+
+fail:
+	rtmp_multi_destroy(multi);
+	return NULL;
+}
+
+static void rtmp_multi_stop(void *data)
+{
+	struct rtmp_multi *multi = data;
+	void *ret;
+
+	os_event_signal(multi->stop_event);
+
+	if (multi->connecting)
+		pthread_join(multi->connect_thread, &ret);
+
+	if (multi->active)
+		obs_output_end_data_capture(multi->output);
+
+	for (size_t i = 0; i < multi->targets.num; i++)
+		os_sem_post(multi->targets.array[i]->send_sem);
+
+	free_targets(multi);
+	free_headers(multi);
+	multi->active = false;
+
+	os_event_reset(multi->stop_event);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool get_next_tag(struct rtmp_target *target,
+		struct rtmp_tag **tag)
+{
+	bool new_tag = false;
+
+	pthread_mutex_lock(&target->tags_mutex);
+	if (target->tags.size) {
+		circlebuf_pop_front(&target->tags, tag, sizeof(*tag));
+		new_tag = true;
+	}
+	pthread_mutex_unlock(&target->tags_mutex);
+
+	return new_tag;
+}
+
+static bool send_tag(struct rtmp_target *target, const struct rtmp_tag *tag)
+{
+	RTMPIOVec iov;
+
+	iov.iov_base = (const char*)tag->data;
+	iov.iov_len  = (int)tag->size;
+
+	if (RTMP_WriteV(&target->rtmp, &iov, 1) < 0)
+		return false;
+
+	target->total_bytes_sent += tag->size;
+	return true;
+}
+
+static bool send_headers(struct rtmp_target *target)
+{
+	struct rtmp_multi *multi = target->multi;
+
+	if (RTMP_Write(&target->rtmp, (char*)multi->meta_data,
+				(int)multi->meta_data_size) < 0)
+		return false;
+
+	return send_tag(target, multi->audio_header) &&
+	       send_tag(target, multi->video_header);
+}
+
+static inline void set_rtmp_str(AVal *val, const char *str)
+{
+	bool valid  = (str && *str);
+	val->av_val = valid ? (char*)str       : NULL;
+	val->av_len = valid ? (int)strlen(str) : 0;
+}
+
+static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
+{
+	bool valid  = !dstr_is_empty(str);
+	val->av_val = valid ? str->array    : NULL;
+	val->av_len = valid ? (int)str->len : 0;
+}
+
+static bool connect_target(struct rtmp_target *target)
+{
+	struct rtmp_multi *multi = target->multi;
+	RTMP *rtmp = &target->rtmp;
+
+	if (dstr_is_empty(&target->url) || dstr_is_empty(&target->key)) {
+		warn("Destination has no URL or stream key, skipping");
+		return false;
+	}
+
+	info("Connecting to RTMP URL %s...", target->url.array);
+
+	if (!RTMP_SetupURL2(rtmp, target->url.array, target->key.array))
+		return false;
+
+	RTMP_EnableWrite(rtmp);
+
+	set_rtmp_dstr(&rtmp->Link.pubUser,   &target->username);
+	set_rtmp_dstr(&rtmp->Link.pubPasswd, &target->password);
+	rtmp->Link.swfUrl = rtmp->Link.tcUrl;
+	set_rtmp_str(&rtmp->Link.flashVer, "FMLE/3.0 (compatible; FMSc/1.0)");
+
+	rtmp->m_outChunkSize       = 16384;
+	rtmp->m_bSendChunkSizeInfo = true;
+	rtmp->m_bUseNagle          = false;
+
+	if (!RTMP_Connect(rtmp, NULL) || !RTMP_ConnectStream(rtmp, 0)) {
+		warn("Connection to %s failed", target->url.array);
+		return false;
+	}
+
+	if (!send_headers(target)) {
+		warn("Failed to send headers to %s", target->url.array);
+		return false;
+	}
+
+	info("Connection to %s successful", target->url.array);
+	return true;
+}
+
+static void target_disconnected(struct rtmp_target *target)
+{
+	struct rtmp_multi *multi = target->multi;
+
+	info("Disconnected from %s", target->url.array);
+
+	pthread_mutex_lock(&target->tags_mutex);
+	target->disconnected = true;
+	free_tags(target);
+	pthread_mutex_unlock(&target->tags_mutex);
+
+	if (os_atomic_dec_long(&multi->num_connected) > 0)
+		return;
+
+	/* the last destination is gone, so the whole output stops */
+	if (os_event_try(multi->stop_event) == EAGAIN) {
+		pthread_detach(target->send_thread);
+		target->thread_created = false;
+		multi->active = false;
+		obs_output_signal_stop(multi->output, OBS_OUTPUT_DISCONNECTED);
+	}
+}
+
+static bool send_remaining_tags(struct rtmp_target *target)
+{
+	struct rtmp_tag *tag;
+
+	while (get_next_tag(target, &tag)) {
+		bool success = send_tag(target, tag);
+		tag_release(tag);
+
+		if (!success)
+			return false;
+	}
+
+	return true;
+}
+
+/* returns false if the connection was lost, true if the output stopped */
+static bool send_tags(struct rtmp_target *target)
+{
+	struct rtmp_multi *multi = target->multi;
+
+	while (os_sem_wait(target->send_sem) == 0) {
+		struct rtmp_tag *tag;
+		bool success;
+
+		if (os_event_try(multi->stop_event) != EAGAIN)
+			break;
+		if (!get_next_tag(target, &tag))
+			continue;
+
+		success = send_tag(target, tag);
+		tag_release(tag);
+
+		if (!success)
+			return false;
+	}
+
+	return send_remaining_tags(target);
+}
+
+/* nothing is queued to the destination while it's reconnecting.  once it
+ * is back, it waits for the next keyframe like after a full frame drop */
+static bool reconnect_target(struct rtmp_target *target)
+{
+	struct rtmp_multi *multi = target->multi;
+	unsigned long delay_ms = (unsigned long)multi->retry_delay_sec * 1000;
+
+	pthread_mutex_lock(&target->tags_mutex);
+	target->disconnected = true;
+	free_tags(target);
+	pthread_mutex_unlock(&target->tags_mutex);
+
+	for (int i = 0; i < multi->max_retries; i++) {
+		warn("Lost connection to %s, retrying in %d seconds "
+		     "(attempt %d of %d)", target->url.array,
+		     multi->retry_delay_sec, i + 1, multi->max_retries);
+
+		if (os_event_timedwait(multi->stop_event, delay_ms) !=
+				ETIMEDOUT)
+			return false;
+
+		RTMP_Close(&target->rtmp);
+		RTMP_Init(&target->rtmp);
+
+		if (connect_target(target)) {
+			pthread_mutex_lock(&target->tags_mutex);
+			frame_dropper_wait_for_keyframe(&target->dropper);
+			target->disconnected = false;
+			pthread_mutex_unlock(&target->tags_mutex);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void *send_thread(void *data)
+{
+	struct rtmp_target *target = data;
+	struct rtmp_multi  *multi  = target->multi;
+
+	target->connected = connect_target(target);
+	os_sem_post(multi->connect_sem);
+
+	if (!target->connected)
+		return NULL;
+
+	while (!send_tags(target)) {
+		if (!reconnect_target(target)) {
+			if (os_event_try(multi->stop_event) == EAGAIN)
+				target_disconnected(target);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void create_headers(struct rtmp_multi *multi)
+{
+	obs_output_t  *context  = multi->output;
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(context);
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(context);
+	uint8_t       *header;
+	size_t        size;
+
+	struct encoder_packet audio = {
+		.type         = OBS_ENCODER_AUDIO,
+		.timebase_den = 1
+	};
+
+	struct encoder_packet video = {
+		.type         = OBS_ENCODER_VIDEO,
+		.timebase_den = 1,
+		.keyframe     = true
+	};
+
+	flv_meta_data(context, &multi->meta_data, &multi->meta_data_size,
+			false);
+
+	obs_encoder_get_extra_data(aencoder, &header, &audio.size);
+	audio.data = header;
+	flv_packet_mux(&multi->mux, &audio, true);
+	multi->audio_header = create_tag(&multi->mux, &audio);
+
+	obs_encoder_get_extra_data(vencoder, &header, &size);
+	video.size = obs_parse_avc_header(&video.data, header, size);
+	flv_packet_mux(&multi->mux, &video, true);
+	multi->video_header = create_tag(&multi->mux, &video);
+	bfree(video.data);
+}
+
+static void *connect_thread(void *data)
+{
+	struct rtmp_multi *multi = data;
+	size_t num_targets = multi->targets.num;
+	size_t num_connected = 0;
+
+	for (size_t i = 0; i < num_targets; i++) {
+		struct rtmp_target *target = multi->targets.array[i];
+
+		if (pthread_create(&target->send_thread, NULL, send_thread,
+					target) == 0)
+			target->thread_created = true;
+		else
+			os_sem_post(multi->connect_sem);
+	}
+
+	/* destinations connect in parallel, capture starts once all of them
+	 * have either connected or failed so they all start from the same
+	 * keyframe */
+	for (size_t i = 0; i < num_targets; i++)
+		os_sem_wait(multi->connect_sem);
+
+	for (size_t i = 0; i < num_targets; i++)
+		if (multi->targets.array[i]->connected)
+			num_connected++;
+
+	if (os_event_try(multi->stop_event) != EAGAIN) {
+		/* stopped while connecting */
+
+	} else if (!num_connected) {
+		info("Could not connect to any destination");
+		pthread_detach(multi->connect_thread);
+		multi->connecting = false;
+		obs_output_signal_stop(multi->output,
+				OBS_OUTPUT_CONNECT_FAILED);
+		return NULL;
+
+	} else {
+		info("Connected to %d of %d destinations",
+				(int)num_connected, (int)num_targets);
+
+		multi->num_connected = (long)num_connected;
+		multi->active = true;
+		obs_output_begin_data_capture(multi->output, 0);
+	}
+
+	if (os_event_try(multi->stop_event) == EAGAIN)
+		pthread_detach(multi->connect_thread);
+
+	multi->connecting = false;
+	return NULL;
+}
+
+static bool load_targets(struct rtmp_multi *multi, obs_data_t *settings)
+{
+	obs_data_array_t *array = obs_data_get_array(settings, OPT_TARGETS);
+	size_t           count  = obs_data_array_count(array);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t         *item   = obs_data_array_item(array, i);
+		struct rtmp_target *target = target_create(multi, item);
+
+		if (target)
+			da_push_back(multi->targets, &target);
+		obs_data_release(item);
+	}
+
+	obs_data_array_release(array);
+	return multi->targets.num > 0;
+}
+
+static bool rtmp_multi_start(void *data)
+{
+	struct rtmp_multi *multi = data;
+	obs_data_t *settings;
+	bool success;
+
+	if (!obs_output_can_begin_data_capture(multi->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(multi->output, 0))
+		return false;
+
+	/* clean up after a previous run that stopped on its own */
+	free_targets(multi);
+	free_headers(multi);
+
+	os_sem_destroy(multi->connect_sem);
+	if (os_sem_init(&multi->connect_sem, 0) != 0)
+		return false;
+
+	settings = obs_output_get_settings(multi->output);
+	multi->drop_threshold_usec =
+		(int64_t)obs_data_get_int(settings, OPT_DROP_THRESHOLD) * 1000;
+	multi->retry_delay_sec =
+		(int)obs_data_get_int(settings, OPT_RETRY_DELAY);
+	multi->max_retries =
+		(int)obs_data_get_int(settings, OPT_MAX_RETRIES);
+	success = load_targets(multi, settings);
+	obs_data_release(settings);
+
+	if (!success) {
+		warn("No destinations set");
+		return false;
+	}
+
+	create_headers(multi);
+
+	multi->num_connected = 0;
+	multi->connecting = true;
+	if (pthread_create(&multi->connect_thread, NULL, connect_thread,
+				multi) != 0) {
+		multi->connecting = false;
+		return false;
+	}
+
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool add_tag(struct rtmp_target *target, struct rtmp_tag *tag)
+{
+	if (tag->type == OBS_ENCODER_VIDEO) {
+		struct frame_drop_item item;
+
+		get_drop_item(&tag, &item);
+		if (!frame_dropper_check_video(&target->dropper, &item))
+			return false;
+	}
+
+	tag_addref(tag);
+	circlebuf_push_back(&target->tags, &tag, sizeof(tag));
+	frame_dropper_queued(&target->dropper, tag->dts_usec);
+	return true;
+}
+
+static void rtmp_multi_data(void *data, struct encoder_packet *packet)
+{
+	struct rtmp_multi     *multi = data;
+	struct encoder_packet new_packet = *packet;
+	struct rtmp_tag       *tag;
+
+	if (!multi->active)
+		return;
+
+	/* the packet data is only read while muxing, so only the priority
+	 * fields of the local copy are changed */
+	if (packet->type == OBS_ENCODER_VIDEO && !packet->avcc)
+		obs_parse_avc_packet_priority(&new_packet);
+
+	flv_packet_mux(&multi->mux, &new_packet, false);
+	tag = create_tag(&multi->mux, &new_packet);
+
+	for (size_t i = 0; i < multi->targets.num; i++) {
+		struct rtmp_target *target = multi->targets.array[i];
+		bool added_tag = false;
+
+		if (!target->connected)
+			continue;
+
+		pthread_mutex_lock(&target->tags_mutex);
+		if (!target->disconnected)
+			added_tag = add_tag(target, tag);
+		pthread_mutex_unlock(&target->tags_mutex);
+
+		if (added_tag)
+			os_sem_post(target->send_sem);
+	}
+
+	tag_release(tag);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void rtmp_multi_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
+	obs_data_set_default_int(defaults, OPT_RETRY_DELAY, 10);
+	obs_data_set_default_int(defaults, OPT_MAX_RETRIES, 20);
+}
+
+static obs_properties_t *rtmp_multi_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
+			obs_module_text("RTMPStream.DropThreshold"),
+			200, 10000, 100);
+	obs_properties_add_int(props, OPT_RETRY_DELAY,
+			obs_module_text("RTMPMultiStream.RetryDelay"),
+			1, 60, 1);
+	obs_properties_add_int(props, OPT_MAX_RETRIES,
+			obs_module_text("RTMPMultiStream.MaxRetries"),
+			0, 10000, 1);
+	return props;
+}
+
+static uint64_t rtmp_multi_total_bytes_sent(void *data)
+{
+	struct rtmp_multi *multi = data;
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < multi->targets.num; i++)
+		total += multi->targets.array[i]->total_bytes_sent;
+
+	return total;
+}
+
+/* reports the destination that dropped the most, so the count still makes
+ * sense next to the total number of frames */
+static int rtmp_multi_dropped_frames(void *data)
+{
+	struct rtmp_multi *multi = data;
+	int dropped = 0;
+
+	for (size_t i = 0; i < multi->targets.num; i++) {
+		int target_dropped =
+			multi->targets.array[i]->dropper.dropped_frames;
+		if (target_dropped > dropped)
+			dropped = target_dropped;
+	}
+
+	return dropped;
+}
+
+struct obs_output_info rtmp_multi_output_info = {
+	.id                 = "rtmp_multi_output",
+	.flags              = OBS_OUTPUT_AV |
+	                      OBS_OUTPUT_ENCODED |
+	                      OBS_OUTPUT_AVCC,
+	.get_name           = rtmp_multi_getname,
+	.create             = rtmp_multi_create,
+	.destroy            = rtmp_multi_destroy,
+	.start              = rtmp_multi_start,
+	.stop               = rtmp_multi_stop,
+	.encoded_packet     = rtmp_multi_data,
+	.get_defaults       = rtmp_multi_defaults,
+	.get_properties     = rtmp_multi_properties,
+	.get_total_bytes    = rtmp_multi_total_bytes_sent,
+	.get_dropped_frames = rtmp_multi_dropped_frames
+};
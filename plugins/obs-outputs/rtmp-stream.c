@@ -25,6 +25,7 @@
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
 #include "flv-mux.h"
+#include "frame-drop.h"
 
 #define do_log(level, format, ...) \
 	blog(level, "[rtmp stream: '%s'] " format, \
@@ -35,6 +36,17 @@
 #define debug(format, ...) do_log(LOG_DEBUG,   format, ##__VA_ARGS__)
 
 #define OPT_DROP_THRESHOLD "drop_threshold_ms"
+#define OPT_DYN_BITRATE    "dyn_bitrate"
+#define OPT_DYN_MIN_KBPS   "dyn_bitrate_min_kbps"
+#define OPT_DYN_MAX_KBPS   "dyn_bitrate_max_kbps"
+
+/* how often the send rate is measured and the bitrate is reconsidered */
+#define DYN_INTERVAL_NS      1000000000ULL
+
+/* number of uncongested intervals before the bitrate is raised again, and
+ * how much of the ceiling it's raised by each time */
+#define DYN_STABLE_INTERVALS 5
+#define DYN_INCREASE_DIV     20
 
 //#define TEST_FRAMEDROPS
 
@@ -58,13 +70,24 @@ struct rtmp_stream {
 
 	/* frame drop variables */
 	int64_t          drop_threshold_usec;
-	int64_t          min_drop_dts_usec;
-	int              min_priority;
-
-	int64_t          last_dts_usec;
+	struct frame_dropper dropper;
+	struct keyframe_limiter keyframe_limiter;
+
+	/* dynamic bitrate variables */
+	bool             dyn_bitrate;
+	uint32_t         dyn_min_kbps;
+	uint32_t         dyn_max_kbps;
+	uint32_t         dyn_cur_kbps;
+	bool             dyn_changed;
+	uint64_t         dyn_interval_start;
+	uint64_t         dyn_interval_bytes;
+	uint64_t         dyn_interval_audio_bytes;
+	int              dyn_stable_intervals;
 
 	uint64_t         total_bytes_sent;
-	int              dropped_frames;
+
+	struct flv_mux   mux;
+	DARRAY(RTMPIOVec) send_iov;
 
 	RTMP             rtmp;
 };
@@ -87,10 +110,31 @@ static inline void free_packets(struct rtmp_stream *stream)
 	while (stream->packets.size) {
 		struct encoder_packet packet;
 		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-		obs_free_encoder_packet(&packet);
+		obs_encoder_packet_release(&packet);
 	}
 }
 
+static void get_drop_item(const void *item, struct frame_drop_item *info)
+{
+	const struct encoder_packet *packet = item;
+
+	info->type     = packet->type;
+	info->dts_usec = packet->dts_usec;
+	info->keyframe = packet->keyframe;
+	info->priority = packet->priority;
+}
+
+static void release_drop_item(void *item)
+{
+	obs_encoder_packet_release(item);
+}
+
+static const struct frame_drop_queue packet_queue = {
+	.item_size    = sizeof(struct encoder_packet),
+	.get_item     = get_drop_item,
+	.release_item = release_drop_item
+};
+
 static void rtmp_stream_stop(void *data);
 
 static void rtmp_stream_destroy(void *data)
@@ -110,6 +154,10 @@ static void rtmp_stream_destroy(void *data)
 		os_sem_destroy(stream->send_sem);
 		pthread_mutex_destroy(&stream->packets_mutex);
 		circlebuf_free(&stream->packets);
+		frame_dropper_free(&stream->dropper);
+		keyframe_limiter_free(&stream->keyframe_limiter);
+		flv_mux_free(&stream->mux);
+		da_free(stream->send_iov);
 		bfree(stream);
 	}
 }
@@ -119,6 +167,9 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
 	pthread_mutex_init_value(&stream->packets_mutex);
+	pthread_mutex_init_value(&stream->keyframe_limiter.mutex);
+	frame_dropper_init(&stream->dropper, output, &stream->keyframe_limiter,
+			&packet_queue, &stream->packets);
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
@@ -126,6 +177,8 @@ static void *rtmp_stream_create(obs_data_t *settings, obs_output_t *output)
 
 	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
 		goto fail;
+	if (!keyframe_limiter_init(&stream->keyframe_limiter))
+		goto fail;
 	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
 
@@ -190,30 +243,196 @@ static inline bool get_next_packet(struct rtmp_stream *stream,
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t  size;
-	int     ret = 0;
+	struct flv_mux *mux = &stream->mux;
+	int            ret  = 0;
+
+	flv_packet_mux(mux, packet, is_header);
+
+	/* the muxed segments are handed to librtmp as-is, which interleaves
+	 * its chunk headers between them and sends them with a single
+	 * vectored write instead of copying the tag in to one buffer */
+	da_resize(stream->send_iov, mux->iov.num);
+	for (size_t i = 0; i < mux->iov.num; i++) {
+		RTMPIOVec *iov = stream->send_iov.array + i;
+		iov->iov_base = (const char*)mux->iov.array[i].data;
+		iov->iov_len  = (int)mux->iov.array[i].size;
+	}
 
-	flv_packet_mux(packet, &data, &size, is_header);
 #ifdef TEST_FRAMEDROPS
 	os_sleep_ms(rand() % 40);
 #endif
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size);
-	bfree(data);
+	ret = RTMP_WriteV(&stream->rtmp, stream->send_iov.array,
+			(int)stream->send_iov.num);
 
-	obs_free_encoder_packet(packet);
+	stream->total_bytes_sent += mux->size;
 
-	stream->total_bytes_sent += size;
+	stream->dyn_interval_bytes += mux->size;
+	if (packet->type == OBS_ENCODER_AUDIO)
+		stream->dyn_interval_audio_bytes += mux->size;
 	return ret;
 }
 
+static int64_t get_queued_duration(struct rtmp_stream *stream)
+{
+	int64_t duration;
+
+	pthread_mutex_lock(&stream->packets_mutex);
+	duration = frame_dropper_queued_duration(&stream->dropper);
+	pthread_mutex_unlock(&stream->packets_mutex);
+
+	return duration;
+}
+
+static void set_video_bitrate(struct rtmp_stream *stream, uint32_t kbps)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+
+	info("Changing video bitrate from %u to %u kbps",
+			stream->dyn_cur_kbps, kbps);
+
+	if (obs_encoder_set_bitrate(vencoder, kbps)) {
+		stream->dyn_cur_kbps = kbps;
+		stream->dyn_changed  = true;
+	} else {
+		warn("Video encoder does not support changing its bitrate, "
+		     "disabling dynamic bitrate");
+		stream->dyn_bitrate = false;
+	}
+}
+
+/* the encoder goes back to its configured bitrate, but only if the bitrate
+ * is still the one this output set */
+static void restore_video_bitrate(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+
+	if (!stream->dyn_changed)
+		return;
+
+	if (obs_encoder_get_bitrate(vencoder) == stream->dyn_cur_kbps)
+		obs_encoder_set_bitrate(vencoder, 0);
+
+	stream->dyn_changed = false;
+}
+
+/* changing the bitrate of an encoder that other outputs use would change
+ * their bitrate too */
+static bool video_encoder_shared(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	return obs_encoder_has_other_active_outputs(vencoder, stream->output);
+}
+
+/* additive increase, multiplicative decrease: when packets start queuing up
+ * the bitrate drops to what the connection actually managed to send in the
+ * last interval, and it's only raised back towards the ceiling in small
+ * steps after the queue has stayed empty for a while.  frame dropping is
+ * left in place as a last resort for sudden stalls. */
+static void update_dyn_bitrate(struct rtmp_stream *stream)
+{
+	uint64_t now     = os_gettime_ns();
+	uint64_t elapsed = now - stream->dyn_interval_start;
+	uint64_t video_bytes;
+	int64_t  queued_usec;
+	uint32_t sent_kbps;
+	uint32_t new_kbps;
+
+	if (elapsed < DYN_INTERVAL_NS)
+		return;
+
+	if (video_encoder_shared(stream)) {
+		warn("Video encoder is now used by other outputs, disabling "
+		     "dynamic bitrate");
+		restore_video_bitrate(stream);
+		stream->dyn_bitrate = false;
+		return;
+	}
+
+	queued_usec = get_queued_duration(stream);
+	video_bytes = stream->dyn_interval_bytes -
+		stream->dyn_interval_audio_bytes;
+	sent_kbps   = (uint32_t)(video_bytes * 8000000ULL / elapsed);
+	new_kbps    = stream->dyn_cur_kbps;
+
+	if (queued_usec > stream->drop_threshold_usec / 4) {
+		/* leave some headroom so the queue can drain */
+		new_kbps = sent_kbps * 8 / 10;
+		if (new_kbps > stream->dyn_cur_kbps * 9 / 10)
+			new_kbps = stream->dyn_cur_kbps * 9 / 10;
+
+		stream->dyn_stable_intervals = 0;
+
+	} else if (queued_usec < stream->drop_threshold_usec / 10) {
+		if (++stream->dyn_stable_intervals >= DYN_STABLE_INTERVALS) {
+			new_kbps += stream->dyn_max_kbps / DYN_INCREASE_DIV;
+			stream->dyn_stable_intervals = 0;
+		}
+	}
+
+	if (new_kbps < stream->dyn_min_kbps)
+		new_kbps = stream->dyn_min_kbps;
+	if (new_kbps > stream->dyn_max_kbps)
+		new_kbps = stream->dyn_max_kbps;
+
+	if (new_kbps != stream->dyn_cur_kbps)
+		set_video_bitrate(stream, new_kbps);
+
+	stream->dyn_interval_start       = now;
+	stream->dyn_interval_bytes       = 0;
+	stream->dyn_interval_audio_bytes = 0;
+}
+
+static void init_dyn_bitrate(struct rtmp_stream *stream)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(stream->output);
+	uint32_t      bitrate   = obs_encoder_get_bitrate(vencoder);
+
+	stream->dyn_changed              = false;
+	stream->dyn_cur_kbps             = bitrate;
+	stream->dyn_stable_intervals     = 0;
+	stream->dyn_interval_start       = os_gettime_ns();
+	stream->dyn_interval_bytes       = 0;
+	stream->dyn_interval_audio_bytes = 0;
+
+	if (!stream->dyn_bitrate)
+		return;
+
+	if (!bitrate) {
+		warn("Video encoder has no bitrate, disabling dynamic bitrate");
+		stream->dyn_bitrate = false;
+		return;
+	}
+
+	if (video_encoder_shared(stream)) {
+		warn("Video encoder is used by other outputs, disabling "
+		     "dynamic bitrate");
+		stream->dyn_bitrate = false;
+		return;
+	}
+
+	if (!stream->dyn_max_kbps)
+		stream->dyn_max_kbps = bitrate;
+	if (stream->dyn_min_kbps > stream->dyn_max_kbps)
+		stream->dyn_min_kbps = stream->dyn_max_kbps;
+
+	info("Dynamic bitrate enabled: %u - %u kbps",
+			stream->dyn_min_kbps, stream->dyn_max_kbps);
+
+	if (bitrate > stream->dyn_max_kbps)
+		set_video_bitrate(stream, stream->dyn_max_kbps);
+}
+
 static bool send_remaining_packets(struct rtmp_stream *stream)
 {
 	struct encoder_packet packet;
 
-	while (get_next_packet(stream, &packet))
-		if (send_packet(stream, &packet, false) < 0)
+	while (get_next_packet(stream, &packet)) {
+		int ret = send_packet(stream, &packet, false);
+		obs_encoder_packet_release(&packet);
+
+		if (ret < 0)
 			return false;
+	}
 
 	return true;
 }
@@ -225,20 +444,31 @@ static void *send_thread(void *data)
 
 	while (os_sem_wait(stream->send_sem) == 0) {
 		struct encoder_packet packet;
+		int ret;
 
 		if (os_event_try(stream->stop_event) != EAGAIN)
 			break;
 		if (!get_next_packet(stream, &packet))
 			continue;
-		if (send_packet(stream, &packet, false) < 0) {
+
+		ret = send_packet(stream, &packet, false);
+		obs_encoder_packet_release(&packet);
+
+		if (ret < 0) {
 			disconnected = true;
 			break;
 		}
+
+		if (stream->dyn_bitrate)
+			update_dyn_bitrate(stream);
 	}
 
 	if (!disconnected && !send_remaining_packets(stream))
 		disconnected = true;
 
+	/* hand the encoder back at its configured bitrate */
+	restore_video_bitrate(stream);
+
 	if (disconnected) {
 		info("Disconnected from %s", stream->path.array);
 		free_packets(stream);
@@ -277,7 +507,7 @@ static void send_audio_header(struct rtmp_stream *stream)
 	};
 
 	obs_encoder_get_extra_data(aencoder, &header, &packet.size);
-	packet.data = bmemdup(header, packet.size);
+	packet.data = header;
 	send_packet(stream, &packet, true);
 }
 
@@ -297,6 +527,7 @@ static void send_video_header(struct rtmp_stream *stream)
 	obs_encoder_get_extra_data(vencoder, &header, &size);
 	packet.size = obs_parse_avc_header(&packet.data, header, size);
 	send_packet(stream, &packet, true);
+	bfree(packet.data);
 }
 
 static void send_headers(struct rtmp_stream *stream)
@@ -342,6 +573,7 @@ static int init_send(struct rtmp_stream *stream)
 #endif
 
 	reset_semaphore(stream);
+	init_dyn_bitrate(stream);
 
 	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
 	if (ret != 0) {
@@ -383,9 +615,9 @@ static int try_connect(struct rtmp_stream *stream)
 	set_rtmp_str(&stream->rtmp.Link.flashVer,
 			"FMLE/3.0 (compatible; FMSc/1.0)");
 
-	stream->rtmp.m_outChunkSize       = 4096;
+	stream->rtmp.m_outChunkSize       = 16384;
 	stream->rtmp.m_bSendChunkSizeInfo = true;
-	stream->rtmp.m_bUseNagle          = true;
+	stream->rtmp.m_bUseNagle          = false;
 
 	if (!RTMP_Connect(&stream->rtmp, NULL))
 		return OBS_OUTPUT_CONNECT_FAILED;
@@ -425,8 +657,7 @@ static bool rtmp_stream_start(void *data)
 	if (!obs_output_initialize_encoders(stream->output, 0))
 		return false;
 
-	stream->total_bytes_sent = 0;
-	stream->dropped_frames   = 0;
+	stream->total_bytes_sent  = 0;
 
 	settings = obs_output_get_settings(stream->output);
 	dstr_copy(&stream->path,     obs_service_get_url(service));
@@ -435,6 +666,12 @@ static bool rtmp_stream_start(void *data)
 	dstr_copy(&stream->password, obs_service_get_password(service));
 	stream->drop_threshold_usec =
 		(int64_t)obs_data_get_int(settings, OPT_DROP_THRESHOLD) * 1000;
+	frame_dropper_reset(&stream->dropper, stream->drop_threshold_usec);
+	stream->dyn_bitrate  = obs_data_get_bool(settings, OPT_DYN_BITRATE);
+	stream->dyn_min_kbps =
+		(uint32_t)obs_data_get_int(settings, OPT_DYN_MIN_KBPS);
+	stream->dyn_max_kbps =
+		(uint32_t)obs_data_get_int(settings, OPT_DYN_MAX_KBPS);
 	obs_data_release(settings);
 
 	return pthread_create(&stream->connect_thread, NULL, connect_thread,
@@ -446,91 +683,18 @@ static inline bool add_packet(struct rtmp_stream *stream,
 {
 	circlebuf_push_back(&stream->packets, packet,
 			sizeof(struct encoder_packet));
-	stream->last_dts_usec = packet->dts_usec;
+	frame_dropper_queued(&stream->dropper, packet->dts_usec);
 	return true;
 }
 
-static inline size_t num_buffered_packets(struct rtmp_stream *stream)
-{
-	return stream->packets.size / sizeof(struct encoder_packet);
-}
-
-static void drop_frames(struct rtmp_stream *stream)
-{
-	struct circlebuf new_buf            = {0};
-	int              drop_priority      = 0;
-	uint64_t         last_drop_dts_usec = 0;
-	int              num_frames_dropped = 0;
-
-	debug("Previous packet count: %d", (int)num_buffered_packets(stream));
-
-	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
-
-	while (stream->packets.size) {
-		struct encoder_packet packet;
-		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-
-		last_drop_dts_usec = packet.dts_usec;
-
-		if (packet.type == OBS_ENCODER_AUDIO) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
-		} else {
-			if (drop_priority < packet.drop_priority)
-				drop_priority = packet.drop_priority;
-
-			num_frames_dropped++;
-			obs_free_encoder_packet(&packet);
-		}
-	}
-
-	circlebuf_free(&stream->packets);
-	stream->packets           = new_buf;
-	stream->min_priority      = drop_priority;
-	stream->min_drop_dts_usec = last_drop_dts_usec;
-
-	stream->dropped_frames += num_frames_dropped;
-	debug("New packet count: %d", (int)num_buffered_packets(stream));
-}
-
-static void check_to_drop_frames(struct rtmp_stream *stream)
-{
-	struct encoder_packet first;
-	int64_t buffer_duration_usec;
-
-	if (num_buffered_packets(stream) < 5)
-		return;
-
-	circlebuf_peek_front(&stream->packets, &first, sizeof(first));
-
-	/* do not drop frames if frames were just dropped within this time */
-	if (first.dts_usec < stream->min_drop_dts_usec)
-		return;
-
-	/* if the amount of time stored in the buffered packets waiting to be
-	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
-
-	if (buffer_duration_usec > stream->drop_threshold_usec) {
-		drop_frames(stream);
-		debug("dropping %" PRId64 " worth of frames",
-				buffer_duration_usec);
-	}
-}
-
 static bool add_video_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
-	check_to_drop_frames(stream);
+	struct frame_drop_item item;
 
-	/* if currently dropping frames, drop packets until it reaches the
-	 * desired priority */
-	if (packet->priority < stream->min_priority) {
-		stream->dropped_frames++;
+	get_drop_item(packet, &item);
+	if (!frame_dropper_check_video(&stream->dropper, &item))
 		return false;
-	} else {
-		stream->min_priority = 0;
-	}
 
 	return add_packet(stream, packet);
 }
@@ -541,10 +705,12 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 	struct encoder_packet new_packet;
 	bool                  added_packet;
 
-	if (packet->type == OBS_ENCODER_VIDEO)
-		obs_parse_avc_packet(&new_packet, packet);
-	else
-		obs_duplicate_encoder_packet(&new_packet, packet);
+	obs_encoder_packet_ref(&new_packet, packet);
+
+	/* annex-b packets are converted to AVCC while they're being muxed.
+	 * AVCC packets come with their priority already set by the encoder */
+	if (packet->type == OBS_ENCODER_VIDEO && !packet->avcc)
+		obs_parse_avc_packet_priority(&new_packet);
 
 	pthread_mutex_lock(&stream->packets_mutex);
 
@@ -557,12 +723,15 @@ static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 	if (added_packet)
 		os_sem_post(stream->send_sem);
 	else
-		obs_free_encoder_packet(&new_packet);
+		obs_encoder_packet_release(&new_packet);
 }
 
 static void rtmp_stream_defaults(obs_data_t *defaults)
 {
 	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
+	obs_data_set_default_bool(defaults, OPT_DYN_BITRATE, false);
+	obs_data_set_default_int(defaults, OPT_DYN_MIN_KBPS, 300);
+	obs_data_set_default_int(defaults, OPT_DYN_MAX_KBPS, 0);
 }
 
 static obs_properties_t *rtmp_stream_properties(void *unused)
@@ -574,6 +743,14 @@ static obs_properties_t *rtmp_stream_properties(void *unused)
 	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
 			obs_module_text("RTMPStream.DropThreshold"),
 			200, 10000, 100);
+	obs_properties_add_bool(props, OPT_DYN_BITRATE,
+			obs_module_text("RTMPStream.DynamicBitrate"));
+	obs_properties_add_int(props, OPT_DYN_MIN_KBPS,
+			obs_module_text("RTMPStream.DynamicBitrate.Min"),
+			50, 100000, 50);
+	obs_properties_add_int(props, OPT_DYN_MAX_KBPS,
+			obs_module_text("RTMPStream.DynamicBitrate.Max"),
+			0, 100000, 50);
 	return props;
 }
 
@@ -586,14 +763,15 @@ static uint64_t rtmp_stream_total_bytes_sent(void *data)
 static int rtmp_stream_dropped_frames(void *data)
 {
 	struct rtmp_stream *stream = data;
-	return stream->dropped_frames;
+	return stream->dropper.dropped_frames;
 }
 
 struct obs_output_info rtmp_output_info = {
 	.id                 = "rtmp_output",
 	.flags              = OBS_OUTPUT_AV |
 	                      OBS_OUTPUT_ENCODED |
-	                      OBS_OUTPUT_SERVICE,
+	                      OBS_OUTPUT_SERVICE |
+	                      OBS_OUTPUT_AVCC,
 	.get_name           = rtmp_stream_getname,
 	.create             = rtmp_stream_create,
 	.destroy            = rtmp_stream_destroy,
@@ -0,0 +1,337 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+#include "shm-packet/shm-packet.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[shm packet output: '%s'] " format, \
+			obs_output_get_name(shm->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+
+#define OPT_NAME          "name"
+#define OPT_RING_SIZE     "ring_size_mb"
+
+struct shm_packet_output {
+	obs_output_t     *output;
+	volatile bool    active;
+
+	struct dstr      name;
+	size_t           ring_size;
+
+	/* packets are copied straight in to the ring from the encoded packet
+	 * callback, the copy is no more expensive than queueing them for
+	 * another thread would be.  write_mutex keeps stop from destroying
+	 * the writer under a write */
+	pthread_mutex_t  write_mutex;
+
+	struct shm_packet_writer *writer;
+	bool             sent_video_header;
+	bool             sent_audio_header;
+
+	uint64_t         total_bytes;
+	volatile long    dropped_frames;
+};
+
+static const char *shm_packet_output_getname(void)
+{
+	return obs_module_text("SHMPacketOutput");
+}
+
+static void shm_packet_output_stop(void *data);
+
+static void shm_packet_output_destroy(void *data)
+{
+	struct shm_packet_output *shm = data;
+
+	if (shm->active)
+		shm_packet_output_stop(data);
+
+	pthread_mutex_destroy(&shm->write_mutex);
+	dstr_free(&shm->name);
+	bfree(shm);
+}
+
+static void shm_packet_output_update(void *data, obs_data_t *settings)
+{
+	struct shm_packet_output *shm = data;
+
+	dstr_copy(&shm->name, obs_data_get_string(settings, OPT_NAME));
+	shm->ring_size = (size_t)obs_data_get_int(settings, OPT_RING_SIZE) *
+		1024 * 1024;
+}
+
+static void *shm_packet_output_create(obs_data_t *settings,
+		obs_output_t *output)
+{
+	struct shm_packet_output *shm = bzalloc(sizeof(*shm));
+	shm->output = output;
+	pthread_mutex_init_value(&shm->write_mutex);
+
+	if (pthread_mutex_init(&shm->write_mutex, NULL) != 0) {
+		bfree(shm);
+		return NULL;
+	}
+
+	shm_packet_output_update(shm, settings);
+	return shm;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void write_record(struct shm_packet_output *shm,
+		struct shm_packet_record *record, const uint8_t *data)
+{
+	if (!shm_packet_writer_write(shm->writer, record, data)) {
+		warn("Packet of %u bytes is too large for the ring",
+				record->data_size);
+		os_atomic_inc_long(&shm->dropped_frames);
+		return;
+	}
+
+	shm->total_bytes += record->data_size;
+}
+
+static void write_header(struct shm_packet_output *shm,
+		const struct encoder_packet *packet)
+{
+	struct shm_packet_record record = {0};
+	bool                     video = packet->type == OBS_ENCODER_VIDEO;
+	uint8_t                  *header;
+	uint8_t                  *avcc = NULL;
+	size_t                   size;
+
+	if (!obs_encoder_get_extra_data(packet->encoder, &header, &size))
+		return;
+
+	/* the extra data is always annex-b, readers of AVCC packets get the
+	 * matching avcC record instead */
+	if (video && packet->avcc) {
+		size   = obs_parse_avc_header(&avcc, header, size);
+		header = avcc;
+		record.flags |= SHM_PACKET_FLAG_AVCC;
+	}
+
+	record.type         = video ?
+		SHM_PACKET_VIDEO_HEADER : SHM_PACKET_AUDIO_HEADER;
+	record.track        = (uint32_t)packet->track_idx;
+	record.pts          = packet->pts;
+	record.dts          = packet->dts;
+	record.dts_usec     = packet->dts_usec;
+	record.timebase_num = packet->timebase_num;
+	record.timebase_den = packet->timebase_den;
+	record.data_size    = (uint32_t)size;
+
+	write_record(shm, &record, header);
+	bfree(avcc);
+}
+
+/* codec headers go out before the first packet of each track, and again
+ * before every video keyframe so readers can start at any keyframe */
+static void write_packet(struct shm_packet_output *shm,
+		const struct encoder_packet *packet)
+{
+	struct shm_packet_record record = {0};
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (!shm->sent_video_header && !packet->keyframe)
+			return;
+
+		if (packet->keyframe) {
+			write_header(shm, packet);
+			shm->sent_video_header = true;
+		}
+
+		record.type = SHM_PACKET_VIDEO;
+
+	} else {
+		if (!shm->sent_audio_header) {
+			write_header(shm, packet);
+			shm->sent_audio_header = true;
+		}
+
+		record.type = SHM_PACKET_AUDIO;
+	}
+
+	if (packet->keyframe)
+		record.flags |= SHM_PACKET_FLAG_KEYFRAME;
+	if (packet->avcc)
+		record.flags |= SHM_PACKET_FLAG_AVCC;
+
+	record.track        = (uint32_t)packet->track_idx;
+	record.pts          = packet->pts;
+	record.dts          = packet->dts;
+	record.dts_usec     = packet->dts_usec;
+	record.timebase_num = packet->timebase_num;
+	record.timebase_den = packet->timebase_den;
+	record.priority     = packet->priority;
+	record.data_size    = (uint32_t)packet->size;
+
+	write_record(shm, &record, packet->data);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void fill_stream_info(struct shm_packet_output *shm,
+		struct shm_packet_header *header)
+{
+	obs_encoder_t *vencoder = obs_output_get_video_encoder(shm->output);
+	obs_encoder_t *aencoder = obs_output_get_audio_encoder(shm->output);
+	const struct video_output_info *voi;
+	audio_t *audio = obs_encoder_audio(aencoder);
+
+	voi = video_output_get_info(obs_encoder_video(vencoder));
+
+	header->width       = obs_encoder_get_width(vencoder);
+	header->height      = obs_encoder_get_height(vencoder);
+	header->fps_num     = voi->fps_num;
+	header->fps_den     = voi->fps_den;
+	header->sample_rate = audio_output_get_sample_rate(audio);
+	header->channels    = (uint32_t)audio_output_get_channels(audio);
+
+	strncpy(header->video_codec, obs_encoder_get_codec(vencoder),
+			sizeof(header->video_codec) - 1);
+	strncpy(header->audio_codec, obs_encoder_get_codec(aencoder),
+			sizeof(header->audio_codec) - 1);
+}
+
+static bool shm_packet_output_start(void *data)
+{
+	struct shm_packet_output *shm = data;
+	struct shm_packet_header header = {0};
+	const char *name;
+	bool in_use;
+
+	if (!obs_output_can_begin_data_capture(shm->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(shm->output, 0))
+		return false;
+
+	name = dstr_is_empty(&shm->name) ?
+		SHM_PACKET_DEFAULT_NAME : shm->name.array;
+
+	fill_stream_info(shm, &header);
+
+	shm->writer = shm_packet_writer_create(name, shm->ring_size, &header,
+			&in_use);
+	if (!shm->writer) {
+		if (in_use)
+			warn("Shared memory '%s' is already used by another "
+			     "output, each output needs its own name", name);
+		else
+			warn("Failed to create shared memory '%s'", name);
+		return false;
+	}
+
+	shm->sent_video_header = false;
+	shm->sent_audio_header = false;
+	shm->total_bytes       = 0;
+	shm->dropped_frames    = 0;
+
+	shm->active = true;
+	obs_output_begin_data_capture(shm->output, 0);
+
+	info("Writing packets to shared memory '%s' (%d MB)", name,
+			(int)(shm->ring_size / (1024 * 1024)));
+	return true;
+}
+
+static void shm_packet_output_stop(void *data)
+{
+	struct shm_packet_output *shm = data;
+
+	if (!shm->active)
+		return;
+
+	obs_output_end_data_capture(shm->output);
+
+	pthread_mutex_lock(&shm->write_mutex);
+	shm->active = false;
+	shm_packet_writer_destroy(shm->writer);
+	shm->writer = NULL;
+	pthread_mutex_unlock(&shm->write_mutex);
+
+	info("Shared memory packet output stopped");
+}
+
+static void shm_packet_output_data(void *data, struct encoder_packet *packet)
+{
+	struct shm_packet_output *shm = data;
+
+	if (!shm->active)
+		return;
+
+	pthread_mutex_lock(&shm->write_mutex);
+	if (shm->writer)
+		write_packet(shm, packet);
+	pthread_mutex_unlock(&shm->write_mutex);
+}
+
+static uint64_t shm_packet_output_total_bytes(void *data)
+{
+	struct shm_packet_output *shm = data;
+	return shm->total_bytes;
+}
+
+static int shm_packet_output_dropped_frames(void *data)
+{
+	struct shm_packet_output *shm = data;
+	return (int)shm->dropped_frames;
+}
+
+static void shm_packet_output_defaults(obs_data_t *defaults)
+{
+	obs_data_set_default_string(defaults, OPT_NAME,
+			SHM_PACKET_DEFAULT_NAME);
+	obs_data_set_default_int(defaults, OPT_RING_SIZE, 32);
+}
+
+static obs_properties_t *shm_packet_output_properties(void *unused)
+{
+	UNUSED_PARAMETER(unused);
+
+	obs_properties_t *props = obs_properties_create();
+
+	obs_properties_add_text(props, OPT_NAME,
+			obs_module_text("SHMPacketOutput.Name"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_RING_SIZE,
+			obs_module_text("SHMPacketOutput.RingSize"), 1, 1024, 1);
+	return props;
+}
+
+struct obs_output_info shm_packet_output_info = {
+	.id                 = "shm_packet_output",
+	.flags              = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED |
+	                      OBS_OUTPUT_AVCC,
+	.get_name           = shm_packet_output_getname,
+	.create             = shm_packet_output_create,
+	.destroy            = shm_packet_output_destroy,
+	.start              = shm_packet_output_start,
+	.stop               = shm_packet_output_stop,
+	.update             = shm_packet_output_update,
+	.encoded_packet     = shm_packet_output_data,
+	.get_total_bytes    = shm_packet_output_total_bytes,
+	.get_dropped_frames = shm_packet_output_dropped_frames,
+	.get_defaults       = shm_packet_output_defaults,
+	.get_properties     = shm_packet_output_properties
+};
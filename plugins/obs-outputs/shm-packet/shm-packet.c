@@ -0,0 +1,532 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "shm-packet.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#define RECORD_ALIGN 8
+#define MAX_NAME     256
+
+/* ------------------------------------------------------------------------- */
+/* positions are shared between processes, so every access to them goes
+ * through these with the appropriate barriers */
+
+#ifdef _WIN32
+static inline uint64_t load_pos(volatile uint64_t *pos)
+{
+	return (uint64_t)InterlockedCompareExchange64(
+			(volatile LONG64*)pos, 0, 0);
+}
+
+static inline void store_pos(volatile uint64_t *pos, uint64_t val)
+{
+	InterlockedExchange64((volatile LONG64*)pos, (LONG64)val);
+}
+
+static inline void full_barrier(void)
+{
+	MemoryBarrier();
+}
+#else
+static inline uint64_t load_pos(volatile uint64_t *pos)
+{
+	return __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_pos(volatile uint64_t *pos, uint64_t val)
+{
+	__atomic_store_n(pos, val, __ATOMIC_RELEASE);
+}
+
+static inline void full_barrier(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* mappings */
+
+struct shm_map {
+	struct shm_packet_header *header;
+	uint8_t                  *ring;
+	size_t                   size;
+	char                     name[MAX_NAME];
+#ifdef _WIN32
+	HANDLE                   handle;
+#endif
+};
+
+static inline void get_map_name(char *dst, const char *name)
+{
+#ifdef _WIN32
+	snprintf(dst, MAX_NAME, "Local\\%s", name);
+#else
+	snprintf(dst, MAX_NAME, "/%s", name);
+#endif
+}
+
+#ifndef _WIN32
+/* a writer that crashed leaves its mapping behind, which would keep the
+ * name in use until reboot */
+static bool remove_stale_map(const char *map_name)
+{
+	struct shm_packet_header *header;
+	struct stat st;
+	bool stale = false;
+	int fd = shm_open(map_name, O_RDONLY, 0);
+	if (fd == -1)
+		return errno == ENOENT;
+
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*header)) {
+		header = mmap(NULL, sizeof(*header), PROT_READ, MAP_SHARED,
+				fd, 0);
+		if (header != MAP_FAILED) {
+			/* no magic yet means a writer is still setting up */
+			stale = header->magic == SHM_PACKET_MAGIC &&
+				header->writer_pid &&
+				kill((pid_t)header->writer_pid, 0) == -1 &&
+				errno == ESRCH;
+			munmap(header, sizeof(*header));
+		}
+	}
+
+	close(fd);
+
+	if (stale)
+		shm_unlink(map_name);
+	return stale;
+}
+#endif
+
+static bool map_create(struct shm_map *map, const char *name, size_t size,
+		bool *in_use)
+{
+	void *data;
+
+	get_map_name(map->name, name);
+	map->size = size;
+
+#ifdef _WIN32
+	map->handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+			PAGE_READWRITE, (DWORD)((uint64_t)size >> 32),
+			(DWORD)size, map->name);
+	if (!map->handle)
+		return false;
+
+	/* the mapping is removed with its last handle, so an existing one
+	 * always belongs to a running writer */
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(map->handle);
+		*in_use = true;
+		return false;
+	}
+
+	data = MapViewOfFile(map->handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!data) {
+		CloseHandle(map->handle);
+		return false;
+	}
+#else
+	int fd = shm_open(map->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd == -1 && errno == EEXIST && remove_stale_map(map->name))
+		fd = shm_open(map->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd == -1) {
+		*in_use = errno == EEXIST;
+		return false;
+	}
+
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		shm_unlink(map->name);
+		return false;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		shm_unlink(map->name);
+		return false;
+	}
+#endif
+
+	map->header = data;
+	map->ring   = (uint8_t*)data + SHM_PACKET_DATA_OFFSET;
+	return true;
+}
+
+static bool map_open(struct shm_map *map, const char *name)
+{
+	struct shm_packet_header *header;
+	void *data;
+
+	get_map_name(map->name, name);
+
+#ifdef _WIN32
+	MEMORY_BASIC_INFORMATION info;
+
+	map->handle = OpenFileMappingA(FILE_MAP_READ, FALSE, map->name);
+	if (!map->handle)
+		return false;
+
+	data = MapViewOfFile(map->handle, FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(map->handle);
+		return false;
+	}
+
+	VirtualQuery(data, &info, sizeof(info));
+	map->size = info.RegionSize;
+#else
+	struct stat st;
+	int fd = shm_open(map->name, O_RDONLY, 0);
+	if (fd == -1)
+		return false;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+
+	map->size = (size_t)st.st_size;
+	data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+#endif
+
+	map->header = data;
+	map->ring   = (uint8_t*)data + SHM_PACKET_DATA_OFFSET;
+
+	header = map->header;
+	return map->size > SHM_PACKET_DATA_OFFSET &&
+		header->magic   == SHM_PACKET_MAGIC &&
+		header->version == SHM_PACKET_VERSION &&
+		header->ring_size <= map->size - SHM_PACKET_DATA_OFFSET;
+}
+
+static void map_close(struct shm_map *map, bool remove)
+{
+	if (!map->header)
+		return;
+
+#ifdef _WIN32
+	(void)remove;
+	UnmapViewOfFile(map->header);
+	CloseHandle(map->handle);
+#else
+	munmap(map->header, map->size);
+	if (remove)
+		shm_unlink(map->name);
+#endif
+
+	map->header = NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* ring access */
+
+static void ring_write(uint8_t *ring, uint64_t ring_size, uint64_t pos,
+		const void *data, size_t size)
+{
+	size_t offset = (size_t)(pos & (ring_size - 1));
+	size_t first  = (size_t)ring_size - offset;
+
+	if (first >= size) {
+		memcpy(ring + offset, data, size);
+	} else {
+		memcpy(ring + offset, data, first);
+		memcpy(ring, (const uint8_t*)data + first, size - first);
+	}
+}
+
+static void ring_read(const uint8_t *ring, uint64_t ring_size, uint64_t pos,
+		void *data, size_t size)
+{
+	size_t offset = (size_t)(pos & (ring_size - 1));
+	size_t first  = (size_t)ring_size - offset;
+
+	if (first >= size) {
+		memcpy(data, ring + offset, size);
+	} else {
+		memcpy(data, ring + offset, first);
+		memcpy((uint8_t*)data + first, ring, size - first);
+	}
+}
+
+static inline uint32_t record_size(size_t data_size)
+{
+	size_t size = sizeof(struct shm_packet_record) + data_size;
+	return (uint32_t)((size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1));
+}
+
+/* ------------------------------------------------------------------------- */
+/* writer */
+
+struct shm_packet_writer {
+	struct shm_map           map;
+	uint64_t                 ring_size;
+	uint64_t                 write_pos;
+	uint64_t                 tail_pos;
+	uint64_t                 sequence;
+};
+
+struct shm_packet_writer *shm_packet_writer_create(const char *name,
+		size_t ring_size, const struct shm_packet_header *header,
+		bool *in_use)
+{
+	struct shm_packet_writer *writer;
+	uint64_t size = 4096;
+	bool name_in_use = false;
+
+	if (in_use)
+		*in_use = false;
+
+	while (size < ring_size)
+		size <<= 1;
+
+	writer = calloc(1, sizeof(struct shm_packet_writer));
+	if (!writer)
+		return NULL;
+
+	if (!map_create(&writer->map, name,
+				SHM_PACKET_DATA_OFFSET + (size_t)size,
+				&name_in_use)) {
+		if (in_use)
+			*in_use = name_in_use;
+		free(writer);
+		return NULL;
+	}
+
+	writer->ring_size = size;
+
+	*writer->map.header           = *header;
+	writer->map.header->ring_size = size;
+	writer->map.header->write_pos = 0;
+	writer->map.header->tail_pos  = 0;
+#ifdef _WIN32
+	writer->map.header->writer_pid = (uint32_t)GetCurrentProcessId();
+#else
+	writer->map.header->writer_pid = (uint32_t)getpid();
+#endif
+
+	/* readers check the magic first, so it goes in last */
+	full_barrier();
+	writer->map.header->version = SHM_PACKET_VERSION;
+	writer->map.header->active  = 1;
+	full_barrier();
+	writer->map.header->magic   = SHM_PACKET_MAGIC;
+
+	return writer;
+}
+
+void shm_packet_writer_destroy(struct shm_packet_writer *writer)
+{
+	if (!writer)
+		return;
+
+	writer->map.header->active = 0;
+	full_barrier();
+
+	map_close(&writer->map, true);
+	free(writer);
+}
+
+bool shm_packet_writer_write(struct shm_packet_writer *writer,
+		struct shm_packet_record *record, const uint8_t *data)
+{
+	struct shm_packet_header *header = writer->map.header;
+	uint8_t *ring = writer->map.ring;
+	uint64_t end;
+
+	record->size     = record_size(record->data_size);
+	record->sequence = writer->sequence;
+
+	if (record->size > writer->ring_size / 2)
+		return false;
+
+	/* move the tail past every record that's about to be overwritten,
+	 * and publish it before touching them so readers can tell */
+	end = writer->write_pos + record->size;
+	if (end - writer->tail_pos > writer->ring_size) {
+		while (end - writer->tail_pos > writer->ring_size) {
+			uint32_t size;
+			ring_read(ring, writer->ring_size, writer->tail_pos,
+					&size, sizeof(size));
+			writer->tail_pos += size;
+		}
+
+		store_pos(&header->tail_pos, writer->tail_pos);
+		full_barrier();
+	}
+
+	ring_write(ring, writer->ring_size, writer->write_pos, record,
+			sizeof(*record));
+	ring_write(ring, writer->ring_size,
+			writer->write_pos + sizeof(*record),
+			data, record->data_size);
+
+	writer->write_pos = end;
+	writer->sequence++;
+	store_pos(&header->write_pos, end);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* reader */
+
+struct shm_packet_reader {
+	struct shm_map           map;
+	uint64_t                 read_pos;
+	uint64_t                 next_sequence;
+	uint64_t                 dropped;
+
+	uint8_t                  *data;
+	size_t                   capacity;
+};
+
+struct shm_packet_reader *shm_packet_reader_open(const char *name)
+{
+	struct shm_packet_reader *reader;
+
+	reader = calloc(1, sizeof(struct shm_packet_reader));
+	if (!reader)
+		return NULL;
+
+	if (!map_open(&reader->map, name)) {
+		map_close(&reader->map, false);
+		free(reader);
+		return NULL;
+	}
+
+	reader->read_pos = load_pos(&reader->map.header->write_pos);
+	return reader;
+}
+
+void shm_packet_reader_close(struct shm_packet_reader *reader)
+{
+	if (!reader)
+		return;
+
+	map_close(&reader->map, false);
+	free(reader->data);
+	free(reader);
+}
+
+const struct shm_packet_header *shm_packet_reader_info(
+		const struct shm_packet_reader *reader)
+{
+	return reader ? reader->map.header : NULL;
+}
+
+uint64_t shm_packet_reader_dropped(const struct shm_packet_reader *reader)
+{
+	return reader ? reader->dropped : 0;
+}
+
+static bool ensure_capacity(struct shm_packet_reader *reader, size_t size)
+{
+	uint8_t *data;
+
+	if (size <= reader->capacity)
+		return true;
+
+	data = realloc(reader->data, size);
+	if (!data)
+		return false;
+
+	reader->data     = data;
+	reader->capacity = size;
+	return true;
+}
+
+enum shm_packet_status shm_packet_reader_next(
+		struct shm_packet_reader *reader,
+		struct shm_packet_record *record, const uint8_t **data)
+{
+	struct shm_packet_header *header = reader->map.header;
+	const uint8_t *ring = reader->map.ring;
+	uint64_t ring_size = header->ring_size;
+
+	for (;;) {
+		uint64_t write_pos = load_pos(&header->write_pos);
+		uint64_t tail_pos  = load_pos(&header->tail_pos);
+
+		if (reader->read_pos == write_pos)
+			return header->active ? SHM_PACKET_EMPTY :
+				SHM_PACKET_ENDED;
+
+		/* fell behind, continue from the oldest intact record */
+		if (reader->read_pos < tail_pos ||
+		    reader->read_pos > write_pos) {
+			reader->read_pos = tail_pos;
+			continue;
+		}
+
+		ring_read(ring, ring_size, reader->read_pos, record,
+				sizeof(*record));
+
+		if (record->size < sizeof(*record) ||
+		    record->size > write_pos - reader->read_pos ||
+		    record->data_size > record->size - sizeof(*record)) {
+			reader->read_pos = load_pos(&header->tail_pos);
+			continue;
+		}
+
+		/* skip the record rather than retrying it forever */
+		if (!ensure_capacity(reader, record->data_size)) {
+			reader->read_pos += record->size;
+			return SHM_PACKET_ERROR;
+		}
+
+		ring_read(ring, ring_size, reader->read_pos + sizeof(*record),
+				reader->data, record->data_size);
+
+		/* if the tail moved past this record while it was being
+		 * copied, it may have been overwritten */
+		full_barrier();
+		if (reader->read_pos < load_pos(&header->tail_pos))
+			continue;
+
+		reader->read_pos += record->size;
+
+		if (reader->next_sequence &&
+		    record->sequence > reader->next_sequence)
+			reader->dropped += record->sequence -
+				reader->next_sequence;
+		reader->next_sequence = record->sequence + 1;
+
+		*data = reader->data;
+		return SHM_PACKET_OK;
+	}
+}
@@ -0,0 +1,191 @@
+/******************************************************************************
+    Copyright (C) 2015 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared memory packet ring
+ *
+ *   Encoded packets are written by a single writer in to a ring buffer in a
+ * named shared memory mapping, and any number of local processes can read
+ * them.  Nothing in this file depends on libobs, so readers only need this
+ * header and shm-packet.c.
+ *
+ *   The mapping starts with a struct shm_packet_header, followed by the ring
+ * at SHM_PACKET_DATA_OFFSET.  Positions in the ring are byte counts that
+ * only ever grow, the offset in to the ring is the position modulo the ring
+ * size.  Each packet is a struct shm_packet_record followed by its data,
+ * padded to 8 bytes.  Records wrap around the end of the ring.
+ *
+ *   The writer never waits for readers.  Before it overwrites old records it
+ * moves tail_pos past them, and a reader that finds its position behind
+ * tail_pos after copying a record knows the record may have been overwritten
+ * and skips ahead to tail_pos instead.  Gaps in the record sequence numbers
+ * tell a reader how many packets it missed.
+ *
+ *   Codec headers (the encoder's extra data) are written as their own
+ * records before the first packet of each track and again before every video
+ * keyframe, so a reader can start decoding from any keyframe.
+ *
+ *   H.264 video is either annex-b or AVCC framed.  With AVCC framing the
+ * packets have SHM_PACKET_FLAG_AVCC set, and so does the video header record,
+ * which then holds an avcC record (AVCDecoderConfigurationRecord) instead of
+ * annex-b SPS and PPS units.
+ */
+
+#define SHM_PACKET_MAGIC         0x5053424FU /* "OBSP" */
+#define SHM_PACKET_VERSION       1
+#define SHM_PACKET_DATA_OFFSET   256
+#define SHM_PACKET_DEFAULT_NAME  "obs-packets"
+
+enum shm_packet_type {
+	SHM_PACKET_VIDEO,
+	SHM_PACKET_AUDIO,
+	SHM_PACKET_VIDEO_HEADER,
+	SHM_PACKET_AUDIO_HEADER
+};
+
+#define SHM_PACKET_FLAG_KEYFRAME (1<<0)
+/* NAL units have 4 byte size prefixes, and video headers are avcC records */
+#define SHM_PACKET_FLAG_AVCC     (1<<1)
+
+struct shm_packet_header {
+	uint32_t          magic;
+	uint32_t          version;
+	uint64_t          ring_size;
+
+	/* end of the newest complete record */
+	volatile uint64_t write_pos;
+	/* start of the oldest record that hasn't been overwritten */
+	volatile uint64_t tail_pos;
+	/* cleared when the writer stops */
+	volatile uint32_t active;
+
+	uint32_t          width;
+	uint32_t          height;
+	uint32_t          fps_num;
+	uint32_t          fps_den;
+	uint32_t          sample_rate;
+	uint32_t          channels;
+	char              video_codec[16];
+	char              audio_codec[16];
+
+	/* process id of the writer */
+	uint32_t          writer_pid;
+};
+
+struct shm_packet_record {
+	/* size of the record including the data and padding */
+	uint32_t          size;
+	uint32_t          type;
+	uint32_t          flags;
+	uint32_t          track;
+	uint64_t          sequence;
+	int64_t           pts;
+	int64_t           dts;
+	int64_t           dts_usec;
+	int32_t           timebase_num;
+	int32_t           timebase_den;
+	int32_t           priority;
+	uint32_t          data_size;
+};
+
+/* ------------------------------------------------------------------------- */
+/* writer */
+
+struct shm_packet_writer;
+
+/**
+ * Creates the named mapping with a ring of ring_size bytes (rounded up to a
+ * power of two).  The stream information in header is copied to the mapping,
+ * the ring related fields are filled in by the writer.
+ *
+ *   A name can only have one writer.  A mapping left behind by a writer
+ * process that no longer exists is replaced.
+ *
+ * @param   in_use  if not NULL, set to whether creating failed because
+ *                  another writer is using the name
+ * @return  NULL if the mapping could not be created
+ */
+extern struct shm_packet_writer *shm_packet_writer_create(const char *name,
+		size_t ring_size, const struct shm_packet_header *header,
+		bool *in_use);
+
+/** Marks the mapping inactive for readers and removes it */
+extern void shm_packet_writer_destroy(struct shm_packet_writer *writer);
+
+/**
+ * Writes a record.  The record's size and sequence are filled in.
+ *
+ * @return  false if the record is too large for the ring
+ */
+extern bool shm_packet_writer_write(struct shm_packet_writer *writer,
+		struct shm_packet_record *record, const uint8_t *data);
+
+/* ------------------------------------------------------------------------- */
+/* reader */
+
+struct shm_packet_reader;
+
+enum shm_packet_status {
+	SHM_PACKET_ERROR = -2,
+	SHM_PACKET_ENDED = -1,
+	SHM_PACKET_EMPTY = 0,
+	SHM_PACKET_OK    = 1
+};
+
+/**
+ * Opens an existing mapping.  Reading starts at the newest packet, so video
+ * can be decoded from the next keyframe on.
+ *
+ * @return  NULL if there is no such mapping or its format is unknown
+ */
+extern struct shm_packet_reader *shm_packet_reader_open(const char *name);
+extern void shm_packet_reader_close(struct shm_packet_reader *reader);
+
+/** Returns the stream information of the mapping */
+extern const struct shm_packet_header *shm_packet_reader_info(
+		const struct shm_packet_reader *reader);
+
+/**
+ * Gets the next record without blocking.  data points to a buffer owned by
+ * the reader, valid until the next call.
+ *
+ * @return  SHM_PACKET_OK if a record was read, SHM_PACKET_EMPTY if there
+ *          is nothing new yet, SHM_PACKET_ENDED if the writer stopped, or
+ *          SHM_PACKET_ERROR if there was no memory for the record's data
+ *          (the record is skipped)
+ */
+extern enum shm_packet_status shm_packet_reader_next(
+		struct shm_packet_reader *reader,
+		struct shm_packet_record *record, const uint8_t **data);
+
+/** Returns the number of records missed because the reader fell behind */
+extern uint64_t shm_packet_reader_dropped(
+		const struct shm_packet_reader *reader);
+
+#ifdef __cplusplus
+}
+#endif
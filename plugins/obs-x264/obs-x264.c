@@ -20,6 +20,7 @@
 #include <util/darray.h>
 #include <util/platform.h>
 #include <obs-module.h>
+#include <obs-avc.h>
 
 #ifndef _STDINT_H_INCLUDED
 #define _STDINT_H_INCLUDED
@@ -43,14 +44,16 @@ struct obs_x264 {
 	x264_param_t           params;
 	x264_t                 *context;
 
-	DARRAY(uint8_t)        packet_data;
-
 	uint8_t                *extra_data;
 	uint8_t                *sei;
 
 	size_t                 extra_data_size;
 	size_t                 sei_size;
 
+	/* the custom options set vbv-maxrate, which bitrate changes leave
+	 * alone */
+	bool                   custom_vbv_maxrate;
+
 	os_performance_token_t *performance_token;
 };
 
@@ -83,7 +86,6 @@ static void obs_x264_destroy(void *data)
 	if (obsx264) {
 		os_end_high_performance(obsx264->performance_token);
 		clear_data(obsx264);
-		da_free(obsx264->packet_data);
 		bfree(obsx264);
 	}
 }
@@ -95,6 +97,7 @@ static void obs_x264_defaults(obs_data_t *settings)
 	obs_data_set_default_int   (settings, "keyint_sec",  0);
 	obs_data_set_default_int   (settings, "crf",         23);
 	obs_data_set_default_bool  (settings, "cbr",         false);
+	obs_data_set_default_string(settings, "latency",     "default");
 
 	obs_data_set_default_string(settings, "preset",      "veryfast");
 	obs_data_set_default_string(settings, "profile",     "");
@@ -117,6 +120,10 @@ static inline void add_strings(obs_property_t *list, const char *const *strings)
 #define TEXT_PROFILE    obs_module_text("Profile")
 #define TEXT_TUNE       obs_module_text("Tune")
 #define TEXT_X264_OPTS  obs_module_text("EncoderOptions")
+#define TEXT_LATENCY    obs_module_text("Latency")
+#define TEXT_LAT_DEF    obs_module_text("Latency.Default")
+#define TEXT_LAT_LOW    obs_module_text("Latency.Low")
+#define TEXT_LAT_THRU   obs_module_text("Latency.Throughput")
 
 static obs_properties_t *obs_x264_props(void *unused)
 {
@@ -144,6 +151,12 @@ static obs_properties_t *obs_x264_props(void *unused)
 			OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
 	add_strings(list, x264_tune_names);
 
+	list = obs_properties_add_list(props, "latency", TEXT_LATENCY,
+			OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(list, TEXT_LAT_DEF,  "default");
+	obs_property_list_add_string(list, TEXT_LAT_LOW,  "low");
+	obs_property_list_add_string(list, TEXT_LAT_THRU, "throughput");
+
 	obs_properties_add_text(props, "x264opts", TEXT_X264_OPTS,
 			OBS_TEXT_DEFAULT);
 
@@ -166,6 +179,38 @@ static bool getparam(const char *param, char **name, const char **value)
 	return true;
 }
 
+/* x264 accepts '_' in place of '-' in option names, so the name is returned
+ * with '-' only */
+static char *get_param_name(const char *param)
+{
+	char       *name;
+	const char *val;
+
+	if (!getparam(param, &name, &val))
+		return NULL;
+
+	for (char *ch = name; *ch; ch++) {
+		if (*ch == '_')
+			*ch = '-';
+	}
+
+	return name;
+}
+
+static bool has_param(char **params, const char *param_name)
+{
+	bool found = false;
+
+	while (*params && !found) {
+		char *name = get_param_name(*(params++));
+
+		found = name && strcmp(name, param_name) == 0;
+		bfree(name);
+	}
+
+	return found;
+}
+
 static const char *validate(struct obs_x264 *obsx264,
 		const char *val, const char *name,
 		const char *const *list)
@@ -287,6 +332,39 @@ static void log_x264(void *param, int level, const char *format, va_list args)
 	UNUSED_PARAMETER(level);
 }
 
+/*
+ * "low" encodes each frame with sliced threads (one slice per core) and
+ * without lookahead or b-frames, so a frame comes out of the encoder as soon
+ * as it went in.  "throughput" uses frame threads, one per core rather than
+ * x264's default of 1.5 per core, which keeps the delay at a known number of
+ * frames even on machines with a lot of cores.  "default" leaves all of it to
+ * the preset and tune.
+ */
+static void apply_latency_profile(struct obs_x264 *obsx264,
+		const char *latency)
+{
+	int cores = os_get_logical_cores();
+
+	if (cores < 1)
+		cores = 1;
+
+	if (astrcmpi(latency, "low") == 0) {
+		obsx264->params.b_sliced_threads    = true;
+		obsx264->params.i_threads           = cores;
+		obsx264->params.i_lookahead_threads = 1;
+		obsx264->params.i_sync_lookahead    = 0;
+		obsx264->params.i_bframe            = 0;
+		obsx264->params.rc.i_lookahead      = 0;
+		obsx264->params.rc.b_mb_tree        = false;
+
+	} else if (astrcmpi(latency, "throughput") == 0) {
+		obsx264->params.b_sliced_threads    = false;
+		obsx264->params.i_threads           = cores;
+		obsx264->params.i_lookahead_threads = cores >= 6 ? cores / 6 : 1;
+		obsx264->params.i_sync_lookahead    = 0;
+	}
+}
+
 static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 		char **params)
 {
@@ -300,6 +378,7 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 	int width        = (int)obs_encoder_get_width(obsx264->encoder);
 	int height       = (int)obs_encoder_get_height(obsx264->encoder);
 	bool cbr         = obs_data_get_bool(settings, "cbr");
+	const char *latency = obs_data_get_string(settings, "latency");
 
 	if (keyint_sec)
 		obsx264->params.i_keyint_max =
@@ -340,6 +419,9 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 	else
 		obsx264->params.i_csp = X264_CSP_NV12;
 
+	apply_latency_profile(obsx264, latency);
+
+	obsx264->custom_vbv_maxrate = has_param(params, "vbv-maxrate");
 	while (*params)
 		set_param(obsx264, *(params++));
 
@@ -351,13 +433,15 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t *settings,
 	     "\twidth:       %d\n"
 	     "\theight:      %d\n"
 	     "\tkeyint:      %d\n"
-	     "\tcbr:         %s",
+	     "\tcbr:         %s\n"
+	     "\tlatency:     %s",
 	     obsx264->params.rc.i_vbv_max_bitrate,
 	     obsx264->params.rc.i_vbv_buffer_size,
 	     voi->fps_num, voi->fps_den,
 	     width, height,
 	     obsx264->params.i_keyint_max,
-	     cbr ? "on" : "off");
+	     cbr ? "on" : "off",
+	     latency);
 }
 
 static bool update_settings(struct obs_x264 *obsx264, obs_data_t *settings)
@@ -394,6 +478,12 @@ static bool update_settings(struct obs_x264 *obsx264, obs_data_t *settings)
 
 	obsx264->params.b_repeat_headers = false;
 
+	/* packets are output AVCC framed when every output using the encoder
+	 * takes them, which saves FLV and MP4 outputs from converting them
+	 * (see OBS_ENCODER_CAP_AVCC) */
+	obsx264->params.b_annexb         =
+		!obs_encoder_avcc_enabled(obsx264->encoder);
+
 	strlist_free(paramlist);
 	bfree(preset);
 	bfree(profile);
@@ -402,20 +492,109 @@ static bool update_settings(struct obs_x264 *obsx264, obs_data_t *settings)
 	return success;
 }
 
+static const char *const rate_control_params[] = {
+	"bitrate",
+	"vbv-maxrate",
+	"vbv-bufsize",
+	"crf",
+	NULL
+};
+
+static bool is_rate_control_param(const char *param)
+{
+	const char *const *list = rate_control_params;
+	char       *name = get_param_name(param);
+	bool       found = false;
+
+	if (!name)
+		return false;
+
+	while (*list) {
+		if (strcmp(name, *(list++)) == 0) {
+			found = true;
+			break;
+		}
+	}
+
+	bfree(name);
+	return found;
+}
+
+/* only the rate control values can be changed on an open encoder, so don't
+ * run through the whole set of parameters (and custom options) again.  the
+ * rate control options among the custom options still take precedence over
+ * the settings, same as when the encoder was created */
+static void update_rate_control(struct obs_x264 *obsx264,
+		obs_data_t *settings)
+{
+	int bitrate      = (int)obs_data_get_int(settings, "bitrate");
+	int buffer_size  = (int)obs_data_get_int(settings, "buffer_size");
+	int crf          = (int)obs_data_get_int(settings, "crf");
+	const char *opts = obs_data_get_string(settings, "x264opts");
+	char **paramlist = strlist_split(opts, ' ', false);
+	char **params    = paramlist;
+
+	obsx264->params.rc.i_vbv_max_bitrate = bitrate;
+	obsx264->params.rc.i_vbv_buffer_size = buffer_size;
+	obsx264->params.rc.i_bitrate         = bitrate;
+
+	if (obsx264->params.rc.i_rc_method == X264_RC_CRF)
+		obsx264->params.rc.f_rf_constant = (float)crf;
+
+	obsx264->custom_vbv_maxrate = has_param(params, "vbv-maxrate");
+	while (*params) {
+		if (is_rate_control_param(*params))
+			set_param(obsx264, *params);
+		params++;
+	}
+
+	strlist_free(paramlist);
+
+	info("rate control changed:\n"
+	     "\tbitrate:     %d\n"
+	     "\tbuffer size: %d\n"
+	     "\tcrf:         %g",
+	     obsx264->params.rc.i_bitrate,
+	     obsx264->params.rc.i_vbv_buffer_size,
+	     obsx264->params.rc.f_rf_constant);
+}
+
 static bool obs_x264_update(void *data, obs_data_t *settings)
 {
 	struct obs_x264 *obsx264 = data;
-	bool success = update_settings(obsx264, settings);
 	int ret;
 
-	if (success) {
-		ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
-		if (ret != 0)
-			warn("Failed to reconfigure: %d", ret);
-		return ret == 0;
-	}
+	if (!obsx264->context)
+		return update_settings(obsx264, settings);
+
+	update_rate_control(obsx264, settings);
+
+	ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
+	if (ret != 0)
+		warn("Failed to reconfigure: %d", ret);
+	return ret == 0;
+}
+
+static bool obs_x264_update_bitrate(void *data, uint32_t bitrate)
+{
+	struct obs_x264 *obsx264 = data;
+	int ret;
+
+	/* CRF has no target bitrate to change */
+	if (obsx264->params.rc.i_rc_method == X264_RC_CRF)
+		return false;
+
+	if (!obsx264->custom_vbv_maxrate)
+		obsx264->params.rc.i_vbv_max_bitrate = (int)bitrate;
+	obsx264->params.rc.i_bitrate = (int)bitrate;
+
+	ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
+	if (ret != 0)
+		warn("Failed to change bitrate to %u: %d", bitrate, ret);
+	else
+		debug("bitrate changed to %u", bitrate);
 
-	return false;
+	return ret == 0;
 }
 
 static void load_headers(struct obs_x264 *obsx264)
@@ -433,11 +612,21 @@ static void load_headers(struct obs_x264 *obsx264)
 	for (int i = 0; i < nal_count; i++) {
 		x264_nal_t *nal = nals+i;
 
-		if (nal->i_type == NAL_SEI)
+		/* the SEI is prepended to the first packet, so it keeps the
+		 * packets' framing.  the headers are expected to be annex-b,
+		 * so with AVCC framing the 4 byte size prefix is swapped for
+		 * a 4 byte start code in place */
+		if (nal->i_type == NAL_SEI) {
 			da_push_back_array(sei, nal->p_payload, nal->i_payload);
-		else
+		} else {
+			size_t offset = header.num;
+
 			da_push_back_array(header, nal->p_payload,
 					nal->i_payload);
+			if (!obsx264->params.b_annexb)
+				obs_avcc_to_annexb(header.array + offset,
+						nal->i_payload);
+		}
 	}
 
 	obsx264->extra_data      = header.array;
@@ -446,6 +635,32 @@ static void load_headers(struct obs_x264 *obsx264)
 	obsx264->sei_size        = sei.num;
 }
 
+/* x264 only resolves automatic thread counts when it opens, so read the
+ * parameters back from the encoder to log what it actually uses */
+static void log_encoder_latency(struct obs_x264 *obsx264)
+{
+	x264_param_t params;
+	int delay = x264_encoder_maximum_delayed_frames(obsx264->context);
+	double frame_ms;
+
+	x264_encoder_parameters(obsx264->context, &params);
+	frame_ms = 1000.0 * (double)params.i_fps_den / (double)params.i_fps_num;
+
+	info("threading:\n"
+	     "\tthreads:           %d (%s)\n"
+	     "\tlookahead threads: %d\n"
+	     "\trc lookahead:      %d\n"
+	     "\tsync lookahead:    %d\n"
+	     "\tb-frames:          %d\n"
+	     "\tencode delay:      %d frames (%.1f ms)",
+	     params.i_threads, params.b_sliced_threads ? "sliced" : "frame",
+	     params.i_lookahead_threads,
+	     params.rc.i_lookahead,
+	     params.i_sync_lookahead,
+	     params.i_bframe,
+	     delay, (double)delay * frame_ms);
+}
+
 static void *obs_x264_create(obs_data_t *settings, obs_encoder_t *encoder)
 {
 	struct obs_x264 *obsx264 = bzalloc(sizeof(struct obs_x264));
@@ -454,10 +669,12 @@ static void *obs_x264_create(obs_data_t *settings, obs_encoder_t *encoder)
 	if (update_settings(obsx264, settings)) {
 		obsx264->context = x264_encoder_open(&obsx264->params);
 
-		if (obsx264->context == NULL)
+		if (obsx264->context == NULL) {
 			warn("x264 failed to load");
-		else
+		} else {
 			load_headers(obsx264);
+			log_encoder_latency(obsx264);
+		}
 	} else {
 		warn("bad settings specified");
 	}
@@ -473,26 +690,31 @@ static void *obs_x264_create(obs_data_t *settings, obs_encoder_t *encoder)
 	return obsx264;
 }
 
-static void parse_packet(struct obs_x264 *obsx264,
-		struct encoder_packet *packet, x264_nal_t *nals,
+static void parse_packet(struct encoder_packet *packet, x264_nal_t *nals,
 		int nal_count, x264_picture_t *pic_out)
 {
-	if (!nal_count) return;
+	size_t size = 0;
 
-	da_resize(obsx264->packet_data, 0);
+	if (!nal_count) return;
 
+	/* x264 guarantees the payloads of all NALs are sequential in memory,
+	 * so the packet can point straight at them.  libobs copies the data
+	 * once before the encoder is called again */
 	for (int i = 0; i < nal_count; i++) {
 		x264_nal_t *nal = nals+i;
-		da_push_back_array(obsx264->packet_data, nal->p_payload,
-				nal->i_payload);
+		size += nal->i_payload;
+
+		if (nal->i_type == NAL_SLICE_IDR || nal->i_type == NAL_SLICE)
+			packet->priority = nal->i_ref_idc;
 	}
 
-	packet->data          = obsx264->packet_data.array;
-	packet->size          = obsx264->packet_data.num;
+	packet->data          = nals[0].p_payload;
+	packet->size          = size;
 	packet->type          = OBS_ENCODER_VIDEO;
 	packet->pts           = pic_out->i_pts;
 	packet->dts           = pic_out->i_dts;
 	packet->keyframe      = pic_out->b_keyframe != 0;
+	packet->drop_priority = obs_avc_get_drop_priority(packet->priority);
 }
 
 static inline void init_pic_data(struct obs_x264 *obsx264, x264_picture_t *pic,
@@ -503,6 +725,9 @@ static inline void init_pic_data(struct obs_x264 *obsx264, x264_picture_t *pic,
 	pic->i_pts = frame->pts;
 	pic->img.i_csp = obsx264->params.i_csp;
 
+	if (frame->force_keyframe)
+		pic->i_type = X264_TYPE_IDR;
+
 	if (obsx264->params.i_csp == X264_CSP_NV12)
 		pic->img.i_plane = 2;
 	else if (obsx264->params.i_csp == X264_CSP_I420)
@@ -537,7 +762,7 @@ static bool obs_x264_encode(void *data, struct encoder_frame *frame,
 	}
 
 	*received_packet = (nal_count != 0);
-	parse_packet(obsx264, packet, nals, nal_count, &pic_out);
+	parse_packet(packet, nals, nal_count, &pic_out);
 
 	return true;
 }
@@ -597,5 +822,8 @@ struct obs_encoder_info obs_x264_encoder = {
 	.get_defaults   = obs_x264_defaults,
 	.get_extra_data = obs_x264_extra_data,
 	.get_sei_data   = obs_x264_sei,
-	.get_video_info = obs_x264_video_info
+	.get_video_info = obs_x264_video_info,
+	.update_bitrate = obs_x264_update_bitrate,
+	.caps           = OBS_ENCODER_CAP_AVCC |
+	                  OBS_ENCODER_CAP_KEYFRAME_REQUEST
 };